@@ -0,0 +1,355 @@
+/**
+ * Characterises an ex2 trace without running it, to pick representative
+ * benchmark traces and to size S: the live set over time, the histograms of
+ * object sizes and lifetimes, the mix of instructions of every process, and
+ * the peak heap that first fit (as in sim2, with the given bookkeeping space)
+ * needs to never run out of room.
+ *
+ * The trace is read once, from the file or from stdin, and only the live
+ * objects are kept in memory. It is either a test.in or a recording of
+ * recorder.so (recognised by its magic), in which threads stand for
+ * processes, addresses for objects and recorded calls for instructions. The
+ * events of a recording are only roughly in order, so they go through a
+ * window of REORDER_WINDOW events sorted by sequence number; events that
+ * arrive after it has moved past them are counted and skipped.
+ *
+ * Lifetimes are in instructions. Sizes are in bytes, and are rounded up to
+ * words for the first fit model. Objects that are never freed are counted
+ * apart from the lifetime histogram. The first fit model takes most of the
+ * time (about a microsecond per allocation and free); --no-fit leaves it out
+ * and reads traces at a few hundred MB/s.
+ *
+ * Usage:
+ *   analyse first_space subsequent_space [trace=stdin] [--no-fit]
+ */
+#include <bits/stdc++.h>
+#include "../dynspace-ex2/placement.hpp"
+#include "../record-ex2/record.h"
+using namespace std;
+constexpr int INST_CONNECT = 0;
+constexpr int INST_DISCONNECT = 1;
+constexpr int INST_READ = 2;
+constexpr int INST_ALLOC = 3;
+constexpr int INST_FREE = 4;
+constexpr size_t PAGE_SIZE = 4096;
+constexpr size_t ALLOWANCE = 256; // the bytes sim2 and gen2 keep free at the end for ex4
+constexpr size_t SAMPLES = 64;
+constexpr size_t REORDER_WINDOW = 1 << 20;
+constexpr size_t READ_BUFFER = 1 << 20;
+const char* const INST_NAMES[] = {"connect", "disconnect", "read", "alloc", "free"};
+struct live_object {
+    uint64_t born;
+    uint64_t bytes;
+    size_t idx;
+    bool live;
+};
+// Counts of values by their bit length, so bucket k holds [2^(k-1), 2^k).
+struct log_histogram {
+    array<uint64_t, 65> counts{};
+    void add(uint64_t v) { ++counts[v == 0 ? 0 : 64 - __builtin_clzll(v)]; }
+    void print(const char* unit) const {
+        uint64_t total = 0;
+        for (uint64_t c : counts) total += c;
+        uint64_t seen = 0;
+        for (size_t k = 0; k != counts.size(); ++k) {
+            if (counts[k] == 0) continue;
+            seen += counts[k];
+            const uint64_t lo = k == 0 ? 0 : uint64_t(1) << (k - 1);
+            const uint64_t hi = k == 0 ? 0 : k == 64 ? UINT64_MAX : (uint64_t(1) << k) - 1;
+            printf("  %12" PRIu64 " - %-12" PRIu64 " %-6s %12" PRIu64 " %6.2f%%  (cumulative %6.2f%%)\n",
+                   lo, hi, unit, counts[k], 100.0 * counts[k] / total, 100.0 * seen / total);
+        }
+    }
+};
+// The maximum live set of every window of `width` instructions, with the windows
+// doubled in width whenever there are more than SAMPLES of them.
+struct live_series {
+    struct sample {
+        uint64_t objects = 0, bytes = 0;
+    };
+    vector<sample> samples;
+    sample last; // windows without allocations or frees hold the live set that was left
+    uint64_t width = 1;
+    void add(uint64_t inst, uint64_t objects, uint64_t bytes) {
+        while (inst / width >= SAMPLES) {
+            for (size_t i = 0; i * 2 < samples.size(); ++i) {
+                const sample b = i * 2 + 1 < samples.size() ? samples[i * 2 + 1] : sample{};
+                samples[i] = {max(samples[i * 2].objects, b.objects), max(samples[i * 2].bytes, b.bytes)};
+            }
+            samples.resize((samples.size() + 1) / 2);
+            width *= 2;
+        }
+        if (samples.size() <= inst / width) samples.resize(inst / width + 1, last);
+        sample& s = samples[inst / width];
+        last = {objects, bytes};
+        s.objects = max(s.objects, objects);
+        s.bytes = max(s.bytes, bytes);
+    }
+};
+struct analysis {
+    size_t front_space, mid_space;
+    bool fit;
+    first_fit_tree heap;
+    uint64_t inst = 0;
+    uint64_t live_objects = 0, live_bytes = 0;
+    uint64_t peak_objects = 0, peak_bytes = 0, peak_bytes_at = 0;
+    uint64_t extent = 0, extent_at = 0; // in words, as first fit lays out the heap
+    uint64_t allocated_bytes = 0;
+    uint64_t invalid = 0;
+    vector<array<uint64_t, 5>> mix; // per process, by instruction type
+    log_histogram sizes, lifetimes;
+    live_series series;
+    analysis(size_t front_space, size_t mid_space, bool fit) : front_space(front_space), mid_space(mid_space), fit(fit), heap(size_t(1) << 48, mid_space) {}
+    void count(size_t p, int type) {
+        if (mix.size() <= p) mix.resize(p + 1);
+        ++mix[p][type];
+        ++inst;
+    }
+    void alloc(live_object& o, size_t p, uint64_t bytes) {
+        count(p, INST_ALLOC);
+        if (o.live) {
+            ++invalid;
+            return;
+        }
+        o = {inst, bytes, 0, true};
+        if (fit) {
+            const size_t words = max<size_t>(1, (bytes + sizeof(size_t) - 1) / sizeof(size_t));
+            o.idx = heap.allocate(words);
+            if (o.idx + words > extent) {
+                extent = o.idx + words;
+                extent_at = inst;
+            }
+        }
+        ++live_objects;
+        live_bytes += bytes;
+        allocated_bytes += bytes;
+        sizes.add(bytes);
+        if (live_bytes > peak_bytes) {
+            peak_bytes = live_bytes;
+            peak_bytes_at = inst;
+        }
+        peak_objects = max(peak_objects, live_objects);
+        series.add(inst, live_objects, live_bytes);
+    }
+    void release(live_object& o, size_t p) {
+        count(p, INST_FREE);
+        if (!o.live) {
+            ++invalid;
+            return;
+        }
+        if (fit) heap.release(o.idx);
+        lifetimes.add(inst - o.born);
+        o.live = false;
+        --live_objects;
+        live_bytes -= o.bytes;
+        series.add(inst, live_objects, live_bytes);
+    }
+    void read(const live_object& o, size_t p) {
+        count(p, INST_READ);
+        if (!o.live) ++invalid;
+    }
+    template <typename F>
+    void report(const char* what, uint64_t header_S, F&& for_each_live) {
+        uint64_t leaked = 0;
+        for_each_live([&](const live_object&) { ++leaked; });
+        printf("%s: %" PRIu64 " instructions, %zu processes, %" PRIu64 " invalid\n", what, inst, mix.size(), invalid);
+
+        printf("\nInstruction mix:\n");
+        printf("  %8s", "process");
+        for (const char* name : INST_NAMES) printf(" %12s", name);
+        printf("\n");
+        array<uint64_t, 5> total{};
+        for (size_t p = 0; p != mix.size(); ++p) {
+            printf("  %8zu", p);
+            for (int t = 0; t != 5; ++t) {
+                printf(" %12" PRIu64, mix[p][t]);
+                total[t] += mix[p][t];
+            }
+            printf("\n");
+        }
+        printf("  %8s", "all");
+        for (int t = 0; t != 5; ++t) printf(" %12" PRIu64, total[t]);
+        printf("\n");
+
+        printf("\nLive set: peak %" PRIu64 " objects, peak %" PRIu64 " bytes at instruction %" PRIu64 ", %" PRIu64 " bytes allocated in total, %" PRIu64 " objects never freed\n",
+               peak_objects, peak_bytes, peak_bytes_at, allocated_bytes, leaked);
+        printf("  %12s %12s %12s\n", "from inst", "max objects", "max bytes");
+        for (size_t i = 0; i != series.samples.size(); ++i) {
+            printf("  %12" PRIu64 " %12" PRIu64 " %12" PRIu64 "\n", i * series.width, series.samples[i].objects, series.samples[i].bytes);
+        }
+
+        printf("\nObject sizes:\n");
+        sizes.print("bytes");
+        printf("\nObject lifetimes (freed objects only):\n");
+        lifetimes.print("insts");
+
+        if (fit) {
+            const uint64_t extent_bytes = front_space + extent * sizeof(size_t);
+            const uint64_t S = (extent_bytes + ALLOWANCE + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+            printf("\nFirst fit: heap extends to %" PRIu64 " bytes at instruction %" PRIu64 " (%.2fx the peak live bytes), S >= %" PRIu64 " needed",
+                   extent_bytes, extent_at, peak_bytes ? double(extent * sizeof(size_t)) / peak_bytes : 0.0, S);
+            if (header_S != 0) printf(", the trace has S = %" PRIu64 "%s", header_S, header_S < S ? " (too small)" : "");
+            printf("\n");
+        }
+    }
+};
+// A buffered reader of the unsigned numbers of a test.in, much faster than scanf on large traces.
+struct number_reader {
+    FILE* f;
+    vector<char> buf = vector<char>(READ_BUFFER);
+    size_t pos = 0, len = 0;
+    // `head` is what was already read from f
+    number_reader(FILE* f, const string& head) : f(f), len(head.size()) { copy(head.begin(), head.end(), buf.begin()); }
+    int peek() {
+        if (pos == len) {
+            len = fread(buf.data(), 1, buf.size(), f);
+            pos = 0;
+            if (len == 0) return EOF;
+        }
+        return (unsigned char)buf[pos];
+    }
+    // the next number on the current line; false at the end of the line or of the input
+    bool next(uint64_t& v) {
+        int c;
+        while ((c = peek()) == ' ' || c == '\t' || c == '\r') ++pos;
+        if (c < '0' || c > '9') return false;
+        v = 0;
+        while ((c = peek()) >= '0' && c <= '9') {
+            v = v * 10 + (c - '0');
+            ++pos;
+        }
+        return true;
+    }
+    // skips the rest of the current line; false at the end of the input
+    bool next_line() {
+        int c;
+        while ((c = peek()) != EOF && c != '\n') ++pos;
+        if (c == EOF) return false;
+        ++pos;
+        return true;
+    }
+};
+void analyse_trace(FILE* f, const string& head, analysis& a) {
+    number_reader in(f, head);
+    uint64_t P = 0, S = 0, B = 0;
+    if (!in.next(P) || !in.next(S) || !in.next(B)) {
+        fprintf(stderr, "The trace does not start with P S B\n");
+        exit(EXIT_FAILURE);
+    }
+    vector<live_object> objects(B);
+    auto object = [&](uint64_t b) -> live_object& {
+        if (b >= objects.size()) objects.resize(b + 1);
+        return objects[b];
+    };
+    while (in.next_line()) {
+        uint64_t type, p, b = 0, s = 0;
+        if (!in.next(type)) continue;
+        if (!in.next(p) || type > INST_FREE || (type >= INST_READ && !in.next(b)) || (type == INST_ALLOC && !in.next(s))) {
+            ++a.invalid;
+            continue;
+        }
+        switch (type) {
+            case INST_CONNECT:
+            case INST_DISCONNECT:
+                a.count(p, type);
+                break;
+            case INST_READ:
+                a.read(object(b), p);
+                break;
+            case INST_ALLOC:
+                a.alloc(object(b), p, s * sizeof(size_t));
+                break;
+            case INST_FREE:
+                a.release(object(b), p);
+                break;
+        }
+    }
+    a.report("test.in", S, [&](auto&& f) {
+        for (const auto& o : objects) if (o.live) f(o);
+    });
+}
+void analyse_recording(FILE* f, analysis& a) {
+    unordered_map<uint64_t, live_object> objects; // address -> object, erased when freed
+    auto later = [](const rec_event& x, const rec_event& y) { return x.seq > y.seq; };
+    priority_queue<rec_event, vector<rec_event>, decltype(later)> window(later);
+    uint64_t next_seq = 0, late = 0, events = 0;
+    auto replay = [&](const rec_event& ev) {
+        next_seq = ev.seq + 1;
+        if (ev.op == REC_MALLOC) {
+            a.alloc(objects[ev.ptr], ev.thread, ev.size);
+            return;
+        }
+        auto it = objects.find(ev.ptr);
+        if (it == objects.end()) {
+            live_object unknown{};
+            a.release(unknown, ev.thread);
+            return;
+        }
+        a.release(it->second, ev.thread);
+        objects.erase(it);
+    };
+    vector<rec_event> buf(READ_BUFFER / sizeof(rec_event));
+    size_t n;
+    while ((n = fread(buf.data(), sizeof(rec_event), buf.size(), f)) != 0) {
+        for (size_t i = 0; i != n; ++i) {
+            ++events;
+            if (buf[i].seq < next_seq) {
+                ++late;
+                continue;
+            }
+            window.push(buf[i]);
+            // the recorder takes no sequence numbers it does not record unless realloc fails,
+            // so gaps are rare and only a full window lets the replay skip one
+            while (!window.empty() && (window.top().seq == next_seq || window.size() > REORDER_WINDOW)) {
+                replay(window.top());
+                window.pop();
+            }
+        }
+    }
+    while (!window.empty()) {
+        replay(window.top());
+        window.pop();
+    }
+    a.report("recording", 0, [&](auto&& f) {
+        for (const auto& [ptr, o] : objects) if (o.live) f(o);
+    });
+    if (late != 0) printf("\n%" PRIu64 " of %" PRIu64 " events arrived too late to be replayed in order and were skipped\n", late, events);
+}
+int main(int argc, char** argv) {
+    bool fit = true;
+    vector<char*> args;
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "--no-fit") == 0) fit = false;
+        else args.push_back(argv[i]);
+    }
+    argc = args.size();
+    argv = args.data();
+    if (argc < 3) {
+        printf("%s first_space subsequent_space [trace=stdin] [--no-fit]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    size_t front_space, mid_space;
+    sscanf(argv[1], "%zu", &front_space);
+    sscanf(argv[2], "%zu", &mid_space);
+    assert(front_space % sizeof(size_t) == 0);
+    assert(mid_space % sizeof(size_t) == 0);
+    front_space -= mid_space;
+    mid_space /= sizeof(size_t);
+
+    FILE* f = stdin;
+    if (argc > 3 && strcmp(argv[3], "-") != 0 && !(f = fopen(argv[3], "rb"))) {
+        perror(argv[3]);
+        return EXIT_FAILURE;
+    }
+    analysis a(front_space, mid_space, fit);
+    // a test.in starts with a digit, so a recording's magic is never the start of one
+    uint64_t magic = 0;
+    size_t got = fread(&magic, 1, sizeof(magic), f);
+    if (got == sizeof(magic) && magic == REC_MAGIC) {
+        analyse_recording(f, a);
+    }
+    else {
+        analyse_trace(f, string(reinterpret_cast<char*>(&magic), got), a);
+    }
+    if (f != stdin) fclose(f);
+}
@@ -0,0 +1,96 @@
+#pragma once
+// Checkpoints of the first-fit ex2 model, written by sim2 and gen2 every K
+// instructions and loadable by either of them to resume from that point.
+// A checkpoint is a flat array of 64-bit words, so it is loaded with a single
+// mmap and used in place:
+//   checkpoint_header
+//   num_chunks words: len << 1 | used, for each chunk in address order (lengths in words)
+//   num_objects checkpoint_objects: the live objects, by id
+// The heap contents are not stored: an object always holds len consecutive
+// values starting at the one written first, so `first` is enough.
+#include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr uint64_t CHECKPOINT_MAGIC = 0x3230747063327865; // "ex2cpt02"
+constexpr uint64_t CHECKPOINT_UNKNOWN = -1; // an offset into an output that is not seekable
+constexpr size_t CHECKPOINT_RNG_WORDS = 320;
+
+struct checkpoint_header {
+    uint64_t magic;
+    uint64_t inst;          // trace lines after the "P S B" line that are already done
+    uint64_t in_offset;     // bytes of the trace up to here, or CHECKPOINT_UNKNOWN
+    uint64_t out_offset;    // bytes of the transcript up to here, or CHECKPOINT_UNKNOWN
+    uint64_t P, S, B;       // S in words, as the chunk list sees it
+    uint64_t front_space;   // bytes before the first chunk
+    uint64_t mid_space;     // words of header per chunk
+    uint64_t disallow_insufficient_space; // 1 if the trace follows the stricter size rules
+    uint64_t next_val;
+    uint64_t num_chunks;
+    uint64_t num_objects;
+    uint64_t rng_words;     // 0 unless written by gen2
+    uint64_t rng[CHECKPOINT_RNG_WORDS]; // the textual state of its mt19937_64, as numbers
+};
+
+struct checkpoint_object {
+    uint64_t id, idx, len, first;
+};
+
+struct checkpoint_view {
+    void* map = MAP_FAILED;
+    size_t size = 0;
+    const checkpoint_header* header = nullptr;
+    const uint64_t* chunks = nullptr;
+    const checkpoint_object* objects = nullptr;
+};
+
+inline std::string checkpoint_path(const std::string& prefix, uint64_t inst) {
+    return prefix + "." + std::to_string(inst);
+}
+
+// Writes to a temporary file first, so a checkpoint that exists is always complete.
+inline bool write_checkpoint(const std::string& path, const checkpoint_header& header, const std::vector<uint64_t>& chunks, const std::vector<checkpoint_object>& objects) {
+    const std::string tmp = path + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f) return false;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = ok && fwrite(chunks.data(), sizeof(uint64_t), chunks.size(), f) == chunks.size();
+    ok = ok && fwrite(objects.data(), sizeof(checkpoint_object), objects.size(), f) == objects.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+inline void unload_checkpoint(checkpoint_view& view) {
+    if (view.map != MAP_FAILED) munmap(view.map, view.size);
+    view = checkpoint_view{};
+}
+
+// Maps the checkpoint at `path`, returning a view with a null header if it is missing or malformed.
+inline checkpoint_view load_checkpoint(const char* path) {
+    checkpoint_view view;
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1) return view;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(checkpoint_header)) {
+        view.size = st.st_size;
+        view.map = mmap(nullptr, view.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (view.map == MAP_FAILED) return view;
+    const auto* header = static_cast<const checkpoint_header*>(view.map);
+    const size_t expected = sizeof(checkpoint_header) + header->num_chunks * sizeof(uint64_t) + header->num_objects * sizeof(checkpoint_object);
+    if (header->magic != CHECKPOINT_MAGIC || header->rng_words > CHECKPOINT_RNG_WORDS || view.size != expected) {
+        unload_checkpoint(view);
+        return view;
+    }
+    view.header = header;
+    view.chunks = reinterpret_cast<const uint64_t*>(header + 1);
+    view.objects = reinterpret_cast<const checkpoint_object*>(view.chunks + header->num_chunks);
+    return view;
+}
@@ -0,0 +1,313 @@
+#pragma once
+// Placement policies for the reference simulator, so that allocators can be
+// compared on ex2-style traces.
+// All lengths and offsets are in words (size_t), and every block, free or used,
+// starts with a mid_space-word header, exactly like the chunks in simulate.cpp.
+// A free block is split when the remainder can hold a header, as in allocate_obj.
+#include <bits/stdc++.h>
+
+constexpr size_t NO_SPACE = -1;
+
+struct heap_model {
+    size_t searched = 0; // index entries (or list chunks) visited by allocate/release
+    virtual ~heap_model() = default;
+    // returns the word index of the object data, or NO_SPACE
+    virtual size_t allocate(size_t len) = 0;
+    virtual void release(size_t idx) = 0;
+    // visits every block in address order as (offset of its header, len, used)
+    virtual void for_each_block(const std::function<void(size_t, size_t, bool)>& f) const = 0;
+};
+
+// Free blocks in a treap ordered by offset, where every node also knows the
+// largest block in its subtree, so the lowest-addressed fit is found in O(log n).
+class free_tree {
+    struct node {
+        size_t off, len, max_len;
+        uint32_t prio;
+        int l, r;
+    };
+    std::vector<node> nodes;
+    std::vector<int> spare;
+    int root = -1;
+    uint32_t seed = 2463534242u;
+    size_t max_of(int t) const { return t < 0 ? 0 : nodes[t].max_len; }
+    void pull(int t) { nodes[t].max_len = std::max({nodes[t].len, max_of(nodes[t].l), max_of(nodes[t].r)}); }
+    // splits t into the nodes with offset < off and the rest
+    void split(int t, size_t off, int& a, int& b, size_t& visited) {
+        if (t < 0) {
+            a = b = -1;
+            return;
+        }
+        ++visited;
+        if (nodes[t].off < off) {
+            split(nodes[t].r, off, nodes[t].r, b, visited);
+            a = t;
+        }
+        else {
+            split(nodes[t].l, off, a, nodes[t].l, visited);
+            b = t;
+        }
+        pull(t);
+    }
+    int merge(int a, int b, size_t& visited) {
+        if (a < 0) return b;
+        if (b < 0) return a;
+        ++visited;
+        if (nodes[a].prio > nodes[b].prio) {
+            nodes[a].r = merge(nodes[a].r, b, visited);
+            pull(a);
+            return a;
+        }
+        nodes[b].l = merge(a, nodes[b].l, visited);
+        pull(b);
+        return b;
+    }
+    size_t find(int t, size_t need, size_t from, size_t& visited) const {
+        if (t < 0 || nodes[t].max_len < need) return NO_SPACE;
+        ++visited;
+        if (nodes[t].off < from) return find(nodes[t].r, need, from, visited);
+        const size_t left = find(nodes[t].l, need, from, visited);
+        if (left != NO_SPACE) return left;
+        if (nodes[t].len >= need) return nodes[t].off;
+        return find(nodes[t].r, need, from, visited);
+    }
+public:
+    void insert(size_t off, size_t len, size_t& visited) {
+        seed ^= seed << 13, seed ^= seed >> 17, seed ^= seed << 5;
+        int t;
+        if (spare.empty()) {
+            t = nodes.size();
+            nodes.push_back({});
+        }
+        else {
+            t = spare.back();
+            spare.pop_back();
+        }
+        nodes[t] = {off, len, len, seed, -1, -1};
+        int a, b;
+        split(root, off, a, b, visited);
+        root = merge(merge(a, t, visited), b, visited);
+    }
+    void erase(size_t off, size_t& visited) {
+        int a, b, c;
+        split(root, off, a, b, visited);
+        split(b, off + 1, b, c, visited);
+        assert(b >= 0 && nodes[b].off == off);
+        spare.push_back(b);
+        root = merge(a, c, visited);
+    }
+    size_t max_len() const { return max_of(root); }
+    // offset of the lowest-addressed block at or after `from` with len >= need
+    size_t first_fit(size_t need, size_t from, size_t& visited) const { return find(root, need, from, visited); }
+};
+
+// Counts comparisons, so that std::set lookups report how much of the index they touched.
+struct counting_less {
+    size_t* count;
+    bool operator()(const std::pair<size_t, size_t>& a, const std::pair<size_t, size_t>& b) const {
+        ++*count;
+        return a < b;
+    }
+};
+using size_index = std::set<std::pair<size_t, size_t>, counting_less>; // (len, offset)
+
+// Address-ordered blocks with O(log n) coalescing; subclasses only provide the free-block index.
+class indexed_heap : public heap_model {
+protected:
+    struct block {
+        size_t len;
+        bool used;
+    };
+    std::map<size_t, block> blocks;
+    size_t mid_space;
+    virtual void index_add(size_t off, size_t len) = 0;
+    virtual void index_remove(size_t off, size_t len) = 0;
+    virtual size_t index_find(size_t len) = 0;
+    virtual void placed(size_t, size_t) {}
+    void init(size_t S) {
+        blocks.emplace(0, block{S, false});
+        index_add(0, S);
+    }
+public:
+    explicit indexed_heap(size_t mid_space) : mid_space(mid_space) {}
+    size_t allocate(size_t len) override {
+        len += mid_space;
+        const size_t off = index_find(len);
+        if (off == NO_SPACE) return NO_SPACE;
+        auto it = blocks.find(off);
+        assert(it != blocks.end() && !it->second.used && it->second.len >= len);
+        index_remove(off, it->second.len);
+        if (it->second.len >= len + mid_space) {
+            blocks.emplace_hint(std::next(it), off + len, block{it->second.len - len, false});
+            index_add(off + len, it->second.len - len);
+            it->second.len = len;
+        }
+        it->second.used = true;
+        placed(off, it->second.len);
+        return off + mid_space;
+    }
+    void release(size_t idx) override {
+        auto it = blocks.find(idx - mid_space);
+        assert(it != blocks.end() && it->second.used);
+        it->second.used = false;
+        auto nx = std::next(it);
+        if (nx != blocks.end() && !nx->second.used) {
+            index_remove(nx->first, nx->second.len);
+            it->second.len += nx->second.len;
+            blocks.erase(nx);
+        }
+        if (it != blocks.begin()) {
+            auto pv = std::prev(it);
+            if (!pv->second.used) {
+                index_remove(pv->first, pv->second.len);
+                pv->second.len += it->second.len;
+                blocks.erase(it);
+                it = pv;
+            }
+        }
+        index_add(it->first, it->second.len);
+    }
+    void for_each_block(const std::function<void(size_t, size_t, bool)>& f) const override {
+        for (const auto& [off, b] : blocks) f(off, b.len, b.used);
+    }
+};
+
+class first_fit_tree : public indexed_heap {
+protected:
+    free_tree tree;
+    void index_add(size_t off, size_t len) override { tree.insert(off, len, searched); }
+    void index_remove(size_t off, size_t) override { tree.erase(off, searched); }
+    size_t index_find(size_t len) override { return tree.first_fit(len, 0, searched); }
+public:
+    first_fit_tree(size_t S, size_t mid_space) : indexed_heap(mid_space) { init(S); }
+};
+
+// Like first fit, but the search starts where the previous allocation ended.
+class next_fit_tree : public first_fit_tree {
+    size_t rover = 0;
+    size_t index_find(size_t len) override {
+        const size_t off = tree.first_fit(len, rover, searched);
+        return off != NO_SPACE ? off : tree.first_fit(len, 0, searched);
+    }
+    void placed(size_t off, size_t len) override { rover = off + len; }
+public:
+    using first_fit_tree::first_fit_tree;
+};
+
+class best_fit_set : public indexed_heap {
+protected:
+    size_index index{counting_less{&searched}};
+    void index_add(size_t off, size_t len) override { index.emplace(len, off); }
+    void index_remove(size_t off, size_t len) override { index.erase({len, off}); }
+    size_t index_find(size_t len) override {
+        auto it = index.lower_bound({len, 0});
+        return it == index.end() ? NO_SPACE : it->second;
+    }
+public:
+    best_fit_set(size_t S, size_t mid_space) : indexed_heap(mid_space) { init(S); }
+};
+
+class worst_fit_set : public best_fit_set {
+    size_t index_find(size_t len) override {
+        if (index.empty() || index.rbegin()->first < len) return NO_SPACE;
+        return index.rbegin()->second;
+    }
+public:
+    using best_fit_set::best_fit_set;
+};
+
+// One size index per power-of-two class: best fit within the class of the
+// request, otherwise the smallest block of the next non-empty class.
+class segregated_fit : public indexed_heap {
+    std::vector<size_index> classes;
+    uint64_t nonempty = 0;
+    static int class_of(size_t len) { return 63 - __builtin_clzll(len | 1); }
+    void index_add(size_t off, size_t len) override {
+        classes[class_of(len)].emplace(len, off);
+        nonempty |= 1ull << class_of(len);
+    }
+    void index_remove(size_t off, size_t len) override {
+        auto& c = classes[class_of(len)];
+        c.erase({len, off});
+        if (c.empty()) nonempty &= ~(1ull << class_of(len));
+    }
+    size_t index_find(size_t len) override {
+        const int k = class_of(len);
+        auto it = classes[k].lower_bound({len, 0});
+        if (it != classes[k].end()) return it->second;
+        const uint64_t above = k == 63 ? 0 : nonempty & ~((2ull << k) - 1);
+        if (above == 0) return NO_SPACE;
+        ++searched;
+        return classes[__builtin_ctzll(above)].begin()->second;
+    }
+public:
+    segregated_fit(size_t S, size_t mid_space) : indexed_heap(mid_space), classes(64, size_index{counting_less{&searched}}) { init(S); }
+};
+
+// Binary buddy system over the heap, split into maximal aligned power-of-two roots.
+class buddy_heap : public heap_model {
+    size_t mid_space;
+    std::vector<std::set<size_t>> free_by_order;
+    std::unordered_map<size_t, int> used; // offset -> order
+public:
+    buddy_heap(size_t S, size_t mid_space) : mid_space(mid_space), free_by_order(64) {
+        for (size_t off = 0; off != S;) {
+            int k = off == 0 ? 63 : __builtin_ctzll(off);
+            while ((1ull << k) > S - off) --k;
+            free_by_order[k].insert(off);
+            off += 1ull << k;
+        }
+    }
+    size_t allocate(size_t len) override {
+        len += mid_space;
+        int k = 0;
+        while ((1ull << k) < len) ++k;
+        int j = k;
+        while (j != 64 && free_by_order[j].empty()) ++j, ++searched;
+        if (j == 64) return NO_SPACE;
+        const size_t off = *free_by_order[j].begin();
+        free_by_order[j].erase(free_by_order[j].begin());
+        while (j != k) {
+            --j;
+            free_by_order[j].insert(off + (1ull << j));
+            ++searched;
+        }
+        used.emplace(off, k);
+        return off + mid_space;
+    }
+    void release(size_t idx) override {
+        size_t off = idx - mid_space;
+        auto it = used.find(off);
+        assert(it != used.end());
+        int k = it->second;
+        used.erase(it);
+        for (; k != 63; ++k) {
+            ++searched;
+            const size_t buddy = off ^ (1ull << k);
+            if (!free_by_order[k].erase(buddy)) break;
+            off = std::min(off, buddy);
+        }
+        free_by_order[k].insert(off);
+    }
+    void for_each_block(const std::function<void(size_t, size_t, bool)>& f) const override {
+        std::vector<std::tuple<size_t, size_t, bool>> all;
+        for (int k = 0; k != 64; ++k) {
+            for (size_t off : free_by_order[k]) all.emplace_back(off, 1ull << k, false);
+        }
+        for (const auto& [off, k] : used) all.emplace_back(off, 1ull << k, true);
+        std::sort(all.begin(), all.end());
+        for (const auto& [off, len, u] : all) f(off, len, u);
+    }
+};
+
+// Policies other than "first", which simulate.cpp keeps on its chunk list so
+// that the transcripts stay identical to the generator's.
+inline std::unique_ptr<heap_model> make_indexed_model(const std::string& policy, size_t S, size_t mid_space) {
+    if (policy == "first-tree") return std::make_unique<first_fit_tree>(S, mid_space);
+    if (policy == "next") return std::make_unique<next_fit_tree>(S, mid_space);
+    if (policy == "best") return std::make_unique<best_fit_set>(S, mid_space);
+    if (policy == "worst") return std::make_unique<worst_fit_set>(S, mid_space);
+    if (policy == "segregated") return std::make_unique<segregated_fit>(S, mid_space);
+    if (policy == "buddy") return std::make_unique<buddy_heap>(S, mid_space);
+    return nullptr;
+}
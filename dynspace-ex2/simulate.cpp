@@ -1,4 +1,6 @@
 #include <bits/stdc++.h>
+#include "placement.hpp"
+#include "checkpoint.hpp"
 using namespace std;
 struct chunk {
     size_t len;
@@ -8,13 +10,30 @@ struct object {
     size_t idx;
     size_t len;
 };
-size_t allocate_obj(forward_list<chunk>& chunks, size_t len, size_t mid_space, bool disallow_insufficient_space) {
+struct snapshot_record {
+    uint64_t inst;          // number of instructions executed so far
+    uint64_t chunks;        // length of the chunk list
+    uint64_t free_blocks;
+    uint64_t free_bytes;
+    uint64_t largest_free;  // in bytes, including its header
+    uint64_t header_bytes;  // first bookkeeping space plus one header per chunk
+    double ext_frag;        // 1 - largest_free / free_bytes
+    double walked_per_op;   // chunks visited per alloc/free since the previous record
+};
+struct snapshot_writer {
+    FILE* out = nullptr;
+    bool binary = false;
+    size_t every = 0;
+    size_t searched = 0, ops = 0;
+};
+size_t allocate_obj(forward_list<chunk>& chunks, size_t len, size_t mid_space, bool disallow_insufficient_space, bool strict, size_t& walked) {
     len += mid_space;
     size_t offset = 0;
     for (auto it = chunks.begin(); it != chunks.end(); ++it) {
+        ++walked;
         if (!it->used && it->len >= len) {
-            assert(it->len != len + mid_space); // safety net in case implementations differ here
-            if (disallow_insufficient_space) assert(it->len == len || it->len > len + mid_space);
+            if (strict) assert(it->len != len + mid_space); // safety net in case implementations differ here
+            if (strict && disallow_insufficient_space) assert(it->len == len || it->len > len + mid_space);
             if (it->len >= len + mid_space) {
                 chunks.insert_after(it, {it->len - len, false});
                 it->len = len;
@@ -24,13 +43,14 @@ size_t allocate_obj(forward_list<chunk>& chunks, size_t len, size_t mid_space, b
         }
         offset += it->len;
     }
-    assert(false); // no suitable space
+    return NO_SPACE;
 }
-void free_obj(forward_list<chunk>& chunks, size_t idx, size_t mid_space) {
+void free_obj(forward_list<chunk>& chunks, size_t idx, size_t mid_space, size_t& walked) {
     idx -= mid_space;
     size_t offset = 0;
     auto prev = chunks.end();
     for (auto it = chunks.begin(); it != chunks.end(); ++it) {
+        ++walked;
         if (offset == idx) {
             it->used = false;
             if (prev != chunks.end() && !prev->used) {
@@ -53,9 +73,156 @@ void free_obj(forward_list<chunk>& chunks, size_t idx, size_t mid_space) {
     }
     assert(false); // cannot find object
 }
+// The original first-fit chunk list, which produces the transcripts that gen2 expects.
+struct first_fit_list : heap_model {
+    forward_list<chunk> chunks;
+    size_t mid_space;
+    bool disallow_insufficient_space, strict;
+    first_fit_list(size_t S, size_t mid_space, bool disallow_insufficient_space, bool strict)
+        : chunks{{S, false}}, mid_space(mid_space), disallow_insufficient_space(disallow_insufficient_space), strict(strict) {}
+    size_t allocate(size_t len) override {
+        return allocate_obj(chunks, len, mid_space, disallow_insufficient_space, strict, searched);
+    }
+    void release(size_t idx) override {
+        free_obj(chunks, idx, mid_space, searched);
+    }
+    void for_each_block(const function<void(size_t, size_t, bool)>& f) const override {
+        size_t offset = 0;
+        for (const auto& c : chunks) {
+            f(offset, c.len, c.used);
+            offset += c.len;
+        }
+    }
+    // replaces the chunk list with the one of a checkpoint
+    void restore(const uint64_t* words, size_t n) {
+        chunks.clear();
+        auto tail = chunks.before_begin();
+        for (size_t i = 0; i != n; ++i) tail = chunks.insert_after(tail, {size_t(words[i] >> 1), bool(words[i] & 1)});
+    }
+};
+const vector<string> POLICIES = {"first", "first-tree", "next", "best", "worst", "segregated", "buddy"};
+unique_ptr<heap_model> make_model(const string& policy, size_t S, size_t mid_space, bool disallow_insufficient_space, bool strict) {
+    if (policy == "first") return make_unique<first_fit_list>(S, mid_space, disallow_insufficient_space, strict);
+    return make_indexed_model(policy, S, mid_space);
+}
+void write_snapshot(snapshot_writer& w, size_t inst, const heap_model& heap, size_t front_space, size_t mid_space) {
+    snapshot_record r{inst, 0, 0, 0, 0, front_space, 0, w.ops ? double(heap.searched - w.searched) / w.ops : 0};
+    heap.for_each_block([&](size_t, size_t len, bool used) {
+        ++r.chunks;
+        r.header_bytes += mid_space;
+        if (!used) {
+            ++r.free_blocks;
+            r.free_bytes += len * sizeof(size_t);
+            r.largest_free = max<uint64_t>(r.largest_free, len * sizeof(size_t));
+        }
+    });
+    if (r.free_bytes != 0) r.ext_frag = 1 - double(r.largest_free) / r.free_bytes;
+    if (w.binary) {
+        fwrite(&r, sizeof(r), 1, w.out);
+    }
+    else {
+        fprintf(w.out, "{\"inst\":%" PRIu64 ",\"chunks\":%" PRIu64 ",\"free_blocks\":%" PRIu64 ",\"free_bytes\":%" PRIu64 ",\"largest_free\":%" PRIu64 ",\"header_bytes\":%" PRIu64 ",\"ext_frag\":%.6f,\"walked_per_op\":%.3f}\n",
+                r.inst, r.chunks, r.free_blocks, r.free_bytes, r.largest_free, r.header_bytes, r.ext_frag, r.walked_per_op);
+    }
+    w.searched = heap.searched;
+    w.ops = 0;
+}
+struct checkpoint_writer {
+    string prefix;
+    size_t every = 0;
+};
+void save_checkpoint(const checkpoint_writer& w, size_t inst, const heap_model& heap, size_t P, size_t S, size_t B, size_t front_space, size_t mid_space, bool disallow_insufficient_space, const object* objects, const size_t* shared_data, size_t next_val) {
+    checkpoint_header h{};
+    h.magic = CHECKPOINT_MAGIC;
+    h.inst = inst;
+    const long in = ftell(stdin);
+    h.in_offset = in == -1 ? CHECKPOINT_UNKNOWN : in;
+    fflush(stdout);
+    const long out = ftell(stdout);
+    h.out_offset = out == -1 ? CHECKPOINT_UNKNOWN : out;
+    h.P = P, h.S = S, h.B = B;
+    h.front_space = front_space;
+    h.mid_space = mid_space;
+    h.disallow_insufficient_space = disallow_insufficient_space;
+    h.next_val = next_val;
+    vector<uint64_t> chunks;
+    heap.for_each_block([&](size_t, size_t len, bool used) { chunks.push_back(uint64_t(len) << 1 | used); });
+    vector<checkpoint_object> live;
+    for (size_t b = 0; b != B; ++b) {
+        if (objects[b].idx != -1u) live.push_back({b, objects[b].idx, objects[b].len, shared_data[objects[b].idx]});
+    }
+    h.num_chunks = chunks.size();
+    h.num_objects = live.size();
+    const string path = checkpoint_path(w.prefix, inst);
+    if (!write_checkpoint(path, h, chunks, live)) perror(path.c_str());
+}
+// Replays only the allocs and frees of a trace through each policy; allocations
+// that do not fit are counted and the object is then treated as never allocated.
+void report(const vector<string>& policies, size_t front_space, size_t mid_space, size_t S, size_t B, bool disallow_insufficient_space) {
+    struct op {
+        size_t b, s; // s == 0 for frees
+    };
+    vector<op> ops;
+    int type;
+    size_t p, b, s;
+    while (scanf("%d%zu", &type, &p) == 2) {
+        if (type == 2) scanf("%zu", &b);
+        if (type == 3 && scanf("%zu%zu", &b, &s) == 2) ops.push_back({b, s});
+        if (type == 4 && scanf("%zu", &b) == 1) ops.push_back({b, 0});
+    }
+    printf("%-12s %12s %14s %12s %10s\n", "policy", "peak_bytes", "failed_allocs", "search/op", "ns/op");
+    for (const auto& policy : policies) {
+        unique_ptr<heap_model> heap = make_model(policy, S, mid_space, disallow_insufficient_space, false);
+        if (!heap) {
+            printf("%-12s unknown policy\n", policy.c_str());
+            continue;
+        }
+        vector<size_t> idx(B, NO_SPACE);
+        size_t peak = 0, failed = 0, done = 0;
+        chrono::nanoseconds elapsed{0};
+        for (const auto& o : ops) {
+            assert(o.b < B);
+            if (o.s != 0) {
+                const auto start = chrono::steady_clock::now();
+                idx[o.b] = heap->allocate(o.s);
+                elapsed += chrono::steady_clock::now() - start;
+                if (idx[o.b] == NO_SPACE) ++failed;
+                else peak = max(peak, idx[o.b] + o.s);
+                ++done;
+            }
+            else if (idx[o.b] != NO_SPACE) {
+                const auto start = chrono::steady_clock::now();
+                heap->release(idx[o.b]);
+                elapsed += chrono::steady_clock::now() - start;
+                idx[o.b] = NO_SPACE;
+                ++done;
+            }
+        }
+        printf("%-12s %12zu %14zu %12.2f %10.1f\n", policy.c_str(), front_space + peak * sizeof(size_t), failed,
+               done ? double(heap->searched) / done : 0, done ? double(elapsed.count()) / done : 0);
+    }
+}
 int main(int argc, char** argv) {
+    string policy;
+    bool report_mode = false;
+    checkpoint_writer checkpoints;
+    const char* resume_path = nullptr;
+    vector<char*> args;
+    for (int i = 0; i != argc; ++i) {
+        if (strncmp(argv[i], "--policy=", 9) == 0) policy = argv[i] + 9;
+        else if (strcmp(argv[i], "--report") == 0) report_mode = true;
+        else if (strncmp(argv[i], "--checkpoint=", 13) == 0) checkpoints.prefix = argv[i] + 13;
+        else if (strncmp(argv[i], "--checkpoint-every=", 19) == 0) checkpoints.every = strtoull(argv[i] + 19, nullptr, 10);
+        else if (strncmp(argv[i], "--resume=", 9) == 0) resume_path = argv[i] + 9;
+        else args.push_back(argv[i]);
+    }
+    argc = args.size();
+    argv = args.data();
     if (argc < 3) {
-        printf("%s first_space subsequent_space [print_val=-1] [disallow_insufficient_space]\n", argv[0]);
+        printf("%s first_space subsequent_space [print_val=-1] [disallow_insufficient_space] [snapshot_every=0 snapshot_file [json|bin]] [--policy=first] [--report] [--checkpoint-every=K --checkpoint=prefix] [--resume=checkpoint]\n", argv[0]);
+        printf("policies:");
+        for (const auto& name : POLICIES) printf(" %s", name.c_str());
+        printf("\n");
         return EXIT_FAILURE;
     }
     size_t front_space, mid_space;
@@ -64,6 +231,16 @@ int main(int argc, char** argv) {
     size_t key = -1;
     if (argc > 3) sscanf(argv[3], "%zu", &key);
     bool disallow_insufficient_space = (argc > 4 && argv[4][0] == '1');
+    snapshot_writer snapshots;
+    if (argc > 6) {
+        sscanf(argv[5], "%zu", &snapshots.every);
+        snapshots.binary = (argc > 7 && strcmp(argv[7], "bin") == 0);
+        snapshots.out = fopen(argv[6], snapshots.binary ? "wb" : "w");
+        if (!snapshots.out) {
+            perror(argv[6]);
+            return EXIT_FAILURE;
+        }
+    }
     assert(front_space % sizeof(size_t) == 0);
     assert(mid_space % sizeof(size_t) == 0);
     front_space -= mid_space;
@@ -72,34 +249,82 @@ int main(int argc, char** argv) {
     assert(S % sizeof(size_t) == 0);
     assert(S > front_space + mid_space);
     S = (S - front_space - 256) / sizeof(size_t); // additional 256 bytes for ex4 allowance, so it hopefully won't affect ex2
+    if (report_mode) {
+        report(policy.empty() ? POLICIES : vector<string>{policy}, front_space, mid_space / sizeof(size_t), S, B, disallow_insufficient_space);
+        return EXIT_SUCCESS;
+    }
+    if (policy.empty()) policy = "first";
+    unique_ptr<heap_model> heap = make_model(policy, S, mid_space / sizeof(size_t), disallow_insufficient_space, true);
+    if (!heap) {
+        printf("Unknown policy %s\n", policy.c_str());
+        return EXIT_FAILURE;
+    }
+    // checkpoints hold the chunk list, which only the first-fit policy keeps
+    if ((checkpoints.every != 0 || resume_path) && policy != "first") {
+        printf("Checkpoints need --policy=first\n");
+        return EXIT_FAILURE;
+    }
+    if (checkpoints.every != 0 && checkpoints.prefix.empty()) {
+        printf("--checkpoint-every needs --checkpoint=prefix\n");
+        return EXIT_FAILURE;
+    }
     unique_ptr<size_t[]> shared_data = make_unique<size_t[]>(S);
-    forward_list<chunk> chunks;
-    chunks.push_front({S, false});
     unique_ptr<object[]> objects = make_unique<object[]>(B);
     size_t next_val = 0;
     fill_n(objects.get(), B, object{-1u, -1u});
+    // reverse index: object id owning the data starting at each word of the heap
+    vector<size_t> owner(S, -1);
+    size_t inst = 0;
+    if (resume_path) {
+        // continue after the checkpointed instruction; the transcript is only the rest
+        checkpoint_view cp = load_checkpoint(resume_path);
+        if (!cp.header) {
+            printf("%s is not a checkpoint\n", resume_path);
+            return EXIT_FAILURE;
+        }
+        const checkpoint_header& h = *cp.header;
+        if (h.P != P || h.S != S || h.B != B || h.front_space != front_space || h.mid_space != mid_space / sizeof(size_t) || h.disallow_insufficient_space != disallow_insufficient_space) {
+            printf("%s was made for a different trace, bookkeeping space or disallow_insufficient_space\n", resume_path);
+            return EXIT_FAILURE;
+        }
+        // seek to the instruction where possible, otherwise skip the lines before it (and the rest of the "P S B" line)
+        if (h.in_offset == CHECKPOINT_UNKNOWN || fseek(stdin, h.in_offset, SEEK_SET) != 0) {
+            for (size_t lines = 0; lines != h.inst + 1;) {
+                const int c = getchar();
+                if (c == EOF) break;
+                if (c == '\n') ++lines;
+            }
+        }
+        static_cast<first_fit_list&>(*heap).restore(cp.chunks, h.num_chunks);
+        for (size_t k = 0; k != h.num_objects; ++k) {
+            const checkpoint_object& o = cp.objects[k];
+            assert(o.id < B && o.idx + o.len <= S);
+            objects[o.id] = {size_t(o.idx), size_t(o.len)};
+            owner[o.idx] = o.id;
+            iota(&shared_data[o.idx], &shared_data[o.idx + o.len], size_t(o.first));
+        }
+        next_val = h.next_val;
+        inst = h.inst;
+        key = key >= inst ? key - inst : -1;
+        unload_checkpoint(cp);
+    }
     int type;
     while (scanf("%d", &type) != EOF) {
         if (key--==0) {
             printf("Current state:\n");
             size_t i = front_space;
-            for (const auto& c : chunks) {
-                printf("[ %zu --- %zu ] %s", i, i + c.len * sizeof(size_t), c.used ? "used" : "free");
-                if (c.used) {
-                    size_t j;
-                    for (j=0; j!=B; ++j) {
-                        if (objects[j].idx * sizeof(size_t) + front_space == i + mid_space) {
-                            printf(" obj:%zu\n", j);
-                            break;
-                        }
-                    }
-                    assert(j!=B);
+            heap->for_each_block([&](size_t, size_t len, bool used) {
+                printf("[ %zu --- %zu ] %s", i, i + len * sizeof(size_t), used ? "used" : "free");
+                if (used) {
+                    const size_t j = owner[(i - front_space + mid_space) / sizeof(size_t)];
+                    assert(j < B);
+                    printf(" obj:%zu\n", j);
                 }
                 else{
                     printf("\n");
                 }
-                i += c.len * sizeof(size_t);
-            }
+                i += len * sizeof(size_t);
+            });
         }
         size_t p, s, b;
         switch (type) {
@@ -134,8 +359,11 @@ int main(int argc, char** argv) {
                 assert(b < B);
                 assert(s > 0);
                 assert(s <= S);
-                objects[b].idx = allocate_obj(chunks, s, mid_space / sizeof(size_t), disallow_insufficient_space);
+                objects[b].idx = heap->allocate(s);
+                assert(objects[b].idx != NO_SPACE); // no suitable space
                 objects[b].len = s;
+                owner[objects[b].idx] = b;
+                ++snapshots.ops;
                 printf("#%zu: Allocated at offset %zu:", p, objects[b].idx * sizeof(size_t) + front_space);
                 for (size_t i = objects[b].idx; i != objects[b].idx + objects[b].len; ++i){
                     printf(" %zu", (shared_data[i] = next_val++));
@@ -150,10 +378,23 @@ int main(int argc, char** argv) {
                 assert(objects[b].idx <= S);
                 assert(objects[b].idx + objects[b].len <= S);
                 printf("#%zu: Freed at offset: %zu\n", p, objects[b].idx * sizeof(size_t) + front_space);
-                free_obj(chunks, objects[b].idx, mid_space / sizeof(size_t));
+                heap->release(objects[b].idx);
+                owner[objects[b].idx] = -1;
                 objects[b] = {-1u, -1u};
+                ++snapshots.ops;
                 break;
             }
         }
+        ++inst;
+        if (snapshots.out && snapshots.every != 0 && inst % snapshots.every == 0) {
+            write_snapshot(snapshots, inst, *heap, front_space, mid_space);
+        }
+        if (checkpoints.every != 0 && inst % checkpoints.every == 0) {
+            save_checkpoint(checkpoints, inst, *heap, P, S, B, front_space, mid_space / sizeof(size_t), disallow_insufficient_space, objects.get(), shared_data.get(), next_val);
+        }
+    }
+    if (snapshots.out) {
+        if (snapshots.every == 0 || inst % snapshots.every != 0) write_snapshot(snapshots, inst, *heap, front_space, mid_space);
+        fclose(snapshots.out);
     }
 }
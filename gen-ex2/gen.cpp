@@ -1,4 +1,5 @@
 #include <bits/stdc++.h>
+#include "../dynspace-ex2/checkpoint.hpp"
 using namespace std;
 constexpr int INST_CONNECT = 0;
 constexpr int INST_DISCONNECT = 1;
@@ -20,14 +21,40 @@ struct instruction {
     int type;
     size_t p, b, s;
 };
-size_t allocate_obj(forward_list<chunk>& chunks, size_t len, size_t mid_space) {
+// Max segment tree over word offsets, holding the length of every free chunk at its
+// offset (0 elsewhere), so the first free chunk of some length is found in O(log S).
+class free_index {
+    size_t n = 1;
+    vector<size_t> t;
+public:
+    explicit free_index(size_t S) {
+        while (n < S) n *= 2;
+        t.assign(2 * n, 0);
+    }
+    void set(size_t offset, size_t len) {
+        size_t i = offset + n;
+        t[i] = len;
+        for (i /= 2; i != 0; i /= 2) t[i] = max(t[2 * i], t[2 * i + 1]);
+    }
+    size_t max_len() const { return t[1]; }
+    // length of the lowest-addressed free chunk with length >= need, or 0 if there is none
+    size_t first_at_least(size_t need) const {
+        if (t[1] < need) return 0;
+        size_t i = 1;
+        while (i < n) i = t[2 * i] >= need ? 2 * i : 2 * i + 1;
+        return t[i];
+    }
+};
+size_t allocate_obj(forward_list<chunk>& chunks, free_index& index, size_t len, size_t mid_space) {
     len += mid_space;
     size_t offset = 0;
     for (auto it = chunks.begin(); it != chunks.end(); ++it) {
         if (!it->used && it->len >= len) {
             assert(it->len != len + mid_space); // safety net in case implementations differ here
+            index.set(offset, 0);
             if (it->len >= len + mid_space) {
                 chunks.insert_after(it, {it->len - len, false});
+                index.set(offset + len, it->len - len);
                 it->len = len;
             }
             it->used = true;
@@ -37,14 +64,16 @@ size_t allocate_obj(forward_list<chunk>& chunks, size_t len, size_t mid_space) {
     }
     assert(false); // no suitable space
 }
-void free_obj(forward_list<chunk>& chunks, size_t idx, size_t mid_space) {
+void free_obj(forward_list<chunk>& chunks, free_index& index, size_t idx, size_t mid_space) {
     idx -= mid_space;
     size_t offset = 0;
     auto prev = chunks.end();
     for (auto it = chunks.begin(); it != chunks.end(); ++it) {
         if (offset == idx) {
             it->used = false;
+            size_t start = offset;
             if (prev != chunks.end() && !prev->used) {
+                start -= prev->len;
                 prev->len += it->len;
                 ++it;
                 chunks.erase_after(prev);
@@ -54,9 +83,11 @@ void free_obj(forward_list<chunk>& chunks, size_t idx, size_t mid_space) {
                 ++it;
             }
             if (it != chunks.end() && !it->used) {
+                index.set(start + prev->len, 0);
                 prev->len += it->len;
                 chunks.erase_after(prev);
             }
+            index.set(start, prev->len);
             return;
         }
         offset += it->len;
@@ -72,7 +103,17 @@ void add_read_instructions(vector<pair<size_t, instruction>>& out, mt19937_64& r
         }
     }
 }
-void add_alloc_instructions(vector<pair<size_t, instruction>>& out, mt19937_64& rng, const forward_list<chunk>& chunks, size_t mid_space, size_t P, size_t S, const object* objects, size_t B, bool disallow_insufficient_space) {
+// A size is disallowed when it would leave a remainder too small to split off
+// (or, with disallow_insufficient_space, too small to be a chunk at all) in the
+// first chunk it fits in, which is where first fit puts it.
+bool is_disallowed(const free_index& index, size_t len, size_t mid_space, bool disallow_insufficient_space) {
+    if (disallow_insufficient_space) {
+        const size_t fit = index.first_at_least(len + mid_space + 1);
+        return fit != 0 && fit <= len + 2 * mid_space;
+    }
+    return index.first_at_least(len + 2 * mid_space) == len + 2 * mid_space;
+}
+void add_alloc_instructions(vector<pair<size_t, instruction>>& out, mt19937_64& rng, const free_index& index, size_t mid_space, size_t P, size_t S, const object* objects, size_t B, bool disallow_insufficient_space) {
     size_t b = 0;
     for (; b!=B; ++b) {
         if (objects[b].idx == -1u) {
@@ -80,33 +121,11 @@ void add_alloc_instructions(vector<pair<size_t, instruction>>& out, mt19937_64&
         }
     }
     if (b == B) return;
-    size_t max_allowlimit = 0;
-    vector<size_t> disallowed_sizes;
-    for (auto it = chunks.begin(); it != chunks.end(); ++it) {
-        if (!it->used) {
-            const size_t allowlimit = it->len - mid_space;
-            if (max_allowlimit < allowlimit) max_allowlimit = allowlimit;
-            if (disallow_insufficient_space) {
-                for (size_t i = max(allowlimit, mid_space) - mid_space; i != allowlimit; ++i) {
-                    if (disallowed_sizes.empty() || disallowed_sizes.back() < i) {
-                        disallowed_sizes.push_back(i);
-                    }
-                }
-            }
-            else {
-                if (allowlimit > mid_space) {
-                    const size_t disallowed_size = allowlimit - mid_space;
-                    if (disallowed_sizes.empty() || disallowed_sizes.back() < disallowed_size) {
-                        disallowed_sizes.push_back(disallowed_size);
-                    }
-                }
-            }
-        }
-    }
+    const size_t max_allowlimit = index.max_len() == 0 ? 0 : index.max_len() - mid_space;
     if (max_allowlimit == 0) return;
     for (size_t i=0; i!=25; ++i) {
         const size_t len = poisson_distribution<size_t>(16)(rng);
-        if (len != 0 && len <= max_allowlimit && !binary_search(disallowed_sizes.begin(), disallowed_sizes.end(), len)) {
+        if (len != 0 && len <= max_allowlimit && !is_disallowed(index, len, mid_space, disallow_insufficient_space)) {
             out.emplace_back(MULTIPLIER_ALLOC, instruction{INST_ALLOC, uniform_int_distribution<size_t>(0, P-1)(rng), b, len});
         }
     }
@@ -119,7 +138,7 @@ void add_free_instructions(vector<pair<size_t, instruction>>& out, mt19937_64& r
         }
     }
 }
-void apply_inst(const instruction& inst, FILE* test_in, FILE* test_out, forward_list<chunk>& chunks, size_t front_space, size_t mid_space, size_t P, size_t* shared_data, size_t S, object* objects, size_t B, size_t& next_val) {
+void apply_inst(const instruction& inst, FILE* test_in, FILE* test_out, forward_list<chunk>& chunks, free_index& index, size_t front_space, size_t mid_space, size_t P, size_t* shared_data, size_t S, object* objects, size_t B, size_t& next_val) {
     fprintf(test_in, "%d ", inst.type);
     switch (inst.type) {
         case INST_READ: {
@@ -141,7 +160,7 @@ void apply_inst(const instruction& inst, FILE* test_in, FILE* test_out, forward_
             assert(inst.b < B);
             assert(inst.s > 0);
             assert(inst.s <= S);
-            objects[inst.b].idx = allocate_obj(chunks, inst.s, mid_space);
+            objects[inst.b].idx = allocate_obj(chunks, index, inst.s, mid_space);
             objects[inst.b].len = inst.s;
             fprintf(test_out, "#%zu: Allocated at offset %zu:", inst.p, objects[inst.b].idx * sizeof(size_t) + front_space);
             for (size_t i = objects[inst.b].idx; i != objects[inst.b].idx + objects[inst.b].len; ++i){
@@ -157,7 +176,7 @@ void apply_inst(const instruction& inst, FILE* test_in, FILE* test_out, forward_
             assert(objects[inst.b].idx <= S);
             assert(objects[inst.b].idx + objects[inst.b].len <= S);
             fprintf(test_out, "#%zu: Freed at offset: %zu\n", inst.p, objects[inst.b].idx * sizeof(size_t) + front_space);
-            free_obj(chunks, objects[inst.b].idx, mid_space);
+            free_obj(chunks, index, objects[inst.b].idx, mid_space);
             objects[inst.b] = {-1u, -1u};
             break;
         }
@@ -166,9 +185,52 @@ void apply_inst(const instruction& inst, FILE* test_in, FILE* test_out, forward_
         }
     }
 }
+// Checkpoints everything the rest of the trace depends on; the free index is rebuilt from the chunks.
+void save_checkpoint(const string& prefix, size_t inst, FILE* test_in, FILE* test_out, const mt19937_64& rng, const forward_list<chunk>& chunks, size_t front_space, size_t mid_space, bool disallow_insufficient_space, size_t P, size_t S, const size_t* shared_data, const object* objects, size_t B, size_t next_val) {
+    checkpoint_header h{};
+    h.magic = CHECKPOINT_MAGIC;
+    h.inst = inst;
+    fflush(test_in);
+    fflush(test_out);
+    const long in = ftell(test_in), out = ftell(test_out);
+    h.in_offset = in == -1 ? CHECKPOINT_UNKNOWN : in;
+    h.out_offset = out == -1 ? CHECKPOINT_UNKNOWN : out;
+    h.P = P, h.S = S, h.B = B;
+    h.front_space = front_space;
+    h.mid_space = mid_space;
+    h.disallow_insufficient_space = disallow_insufficient_space;
+    h.next_val = next_val;
+    ostringstream text;
+    text << rng;
+    istringstream state(text.str());
+    while (h.rng_words != CHECKPOINT_RNG_WORDS && state >> h.rng[h.rng_words]) ++h.rng_words;
+    vector<uint64_t> words;
+    for (const auto& c : chunks) words.push_back(uint64_t(c.len) << 1 | c.used);
+    vector<checkpoint_object> live;
+    for (size_t b=0; b!=B; ++b) {
+        if (objects[b].idx != -1u) live.push_back({b, objects[b].idx, objects[b].len, shared_data[objects[b].idx]});
+    }
+    h.num_chunks = words.size();
+    h.num_objects = live.size();
+    const string path = checkpoint_path(prefix, inst);
+    if (!write_checkpoint(path, h, words, live)) perror(path.c_str());
+}
 int main(int argc, char** argv) {
-    if (argc < 7) {
-        printf("%s first_space subsequent_space num_instructions seed test.in test.out [disallow_insufficient_space]\n", argv[0]);
+    string checkpoint_prefix;
+    size_t checkpoint_every = 0;
+    const char* resume_path = nullptr;
+    vector<char*> args;
+    for (int i=0; i!=argc; ++i) {
+        if (strncmp(argv[i], "--checkpoint=", 13) == 0) checkpoint_prefix = argv[i] + 13;
+        else if (strncmp(argv[i], "--checkpoint-every=", 19) == 0) checkpoint_every = strtoull(argv[i] + 19, nullptr, 10);
+        else if (strncmp(argv[i], "--resume=", 9) == 0) resume_path = argv[i] + 9;
+        else args.push_back(argv[i]);
+    }
+    argc = args.size();
+    argv = args.data();
+    if (argc < 7 || (checkpoint_every != 0 && checkpoint_prefix.empty())) {
+        printf("%s first_space subsequent_space num_instructions seed test.in test.out [disallow_insufficient_space] [--checkpoint-every=K --checkpoint=prefix] [--resume=checkpoint]\n", argv[0]);
+        printf("With --resume, test.in and test.out get only the instructions after the checkpoint.\n");
         return EXIT_FAILURE;
     }
     size_t front_space, mid_space;
@@ -188,26 +250,70 @@ int main(int argc, char** argv) {
     size_t B = uniform_int_distribution<size_t>(50000, 100000)(rng);
     FILE* test_in = fopen(argv[5], "w");
     FILE* test_out = fopen(argv[6], "w");
-    fprintf(test_in, "%zu %zu %zu\n", P, S, B);
+    if (!resume_path) fprintf(test_in, "%zu %zu %zu\n", P, S, B);
     assert(S % sizeof(size_t) == 0);
     assert(S > front_space + mid_space);
     S = (S - front_space - 256) / sizeof(size_t); // additional 256 bytes for ex4 allowance, so it hopefully won't affect ex2
     unique_ptr<size_t[]> shared_data = make_unique<size_t[]>(S);
     forward_list<chunk> chunks;
     chunks.push_front({S, false});
+    free_index index(S);
+    index.set(0, S);
     unique_ptr<object[]> objects = make_unique<object[]>(B);
     size_t next_val = 0;
     fill_n(objects.get(), B, object{-1u, -1u});
-    // connect all
-    for (size_t p=0; p!=P; ++p) {
-        fprintf(test_in, "%d %zu\n", INST_CONNECT, p);
-        fprintf(test_out, "#%zu: Connected\n", p);
+    size_t first_inst = 0;
+    if (resume_path) {
+        // P, S and B above came from the seed; the checkpoint's take their place
+        checkpoint_view cp = load_checkpoint(resume_path);
+        if (!cp.header || cp.header->rng_words == 0 || cp.header->inst < cp.header->P || cp.header->front_space != front_space || cp.header->mid_space != mid_space / sizeof(size_t)) {
+            printf("%s is not a gen2 checkpoint for this bookkeeping space\n", resume_path);
+            return EXIT_FAILURE;
+        }
+        if (cp.header->disallow_insufficient_space != disallow_insufficient_space) {
+            printf("%s was made %s disallow_insufficient_space\n", resume_path, disallow_insufficient_space ? "without" : "with");
+            return EXIT_FAILURE;
+        }
+        const checkpoint_header& h = *cp.header;
+        P = h.P;
+        S = h.S;
+        B = h.B;
+        shared_data = make_unique<size_t[]>(S);
+        objects = make_unique<object[]>(B);
+        fill_n(objects.get(), B, object{-1u, -1u});
+        index = free_index(S);
+        chunks.clear();
+        auto tail = chunks.before_begin();
+        size_t offset = 0;
+        for (size_t k=0; k!=h.num_chunks; ++k) {
+            tail = chunks.insert_after(tail, {size_t(cp.chunks[k] >> 1), bool(cp.chunks[k] & 1)});
+            if (!tail->used) index.set(offset, tail->len);
+            offset += tail->len;
+        }
+        for (size_t k=0; k!=h.num_objects; ++k) {
+            const checkpoint_object& o = cp.objects[k];
+            objects[o.id] = {size_t(o.idx), size_t(o.len)};
+            iota(&shared_data[o.idx], &shared_data[o.idx + o.len], size_t(o.first));
+        }
+        next_val = h.next_val;
+        ostringstream state;
+        for (size_t k=0; k!=h.rng_words; ++k) state << (k ? " " : "") << h.rng[k];
+        istringstream(state.str()) >> rng;
+        first_inst = h.inst - P;
+        unload_checkpoint(cp);
     }
-    for (size_t i=0; i!=num_insts; ++i) {
+    else {
+        // connect all
+        for (size_t p=0; p!=P; ++p) {
+            fprintf(test_in, "%d %zu\n", INST_CONNECT, p);
+            fprintf(test_out, "#%zu: Connected\n", p);
+        }
+    }
+    for (size_t i=first_inst; i<num_insts; ++i) {
         // find an instruction type
         vector<pair<size_t, instruction>> choices;
         add_read_instructions(choices, rng, P, objects.get(), B);
-        add_alloc_instructions(choices, rng, chunks, mid_space / sizeof(size_t), P, S, objects.get(), B, disallow_insufficient_space);
+        add_alloc_instructions(choices, rng, index, mid_space / sizeof(size_t), P, S, objects.get(), B, disallow_insufficient_space);
         add_free_instructions(choices, rng, P, objects.get(), B);
         size_t sum = 0;
         for (const auto& choice : choices) {
@@ -218,11 +324,14 @@ int main(int argc, char** argv) {
         size_t cum = 0;
         for (const auto& choice : choices) {
             if (r < cum + choice.first) {
-                apply_inst(choice.second, test_in, test_out, chunks, front_space, mid_space / sizeof(size_t), P, shared_data.get(), S, objects.get(), B, next_val);
+                apply_inst(choice.second, test_in, test_out, chunks, index, front_space, mid_space / sizeof(size_t), P, shared_data.get(), S, objects.get(), B, next_val);
                 break;
             }
             cum += choice.first;
         }
+        if (checkpoint_every != 0 && (P + i + 1) % checkpoint_every == 0) {
+            save_checkpoint(checkpoint_prefix, P + i + 1, test_in, test_out, rng, chunks, front_space, mid_space / sizeof(size_t), disallow_insufficient_space, P, S, shared_data.get(), objects.get(), B, next_val);
+        }
     }
     // disconnect all
     for (size_t p=0; p!=P; ++p) {
@@ -0,0 +1,313 @@
+/**
+ * This benchmark is the large-scale counterpart of grader_ex1.c: it creates
+ * heaps from 64 KiB up to `max_size`, allocates one object spanning almost all
+ * of the heap, fills it, and hands its handle to 1 up to `max_receivers`
+ * receiver processes, which connect and verify every byte.
+ * Each size and receiver count is run with three ways of mapping the data in:
+ *   lazy     - receivers just read the object, taking every first-touch fault
+ *   populate - receivers prefault the object with MADV_POPULATE_READ first,
+ *              the closest a submission's own mapping gets to MAP_POPULATE
+ *   hugepage - parent and receivers madvise(MADV_HUGEPAGE) the object, so a
+ *              kernel with shmem THP set to "advise" backs it with huge pages
+ * Heaps are created in /dev/shm (skipped when they do not fit there), and data
+ * points whose receivers would verify more than VERIFY_BUDGET bytes in total
+ * are skipped as well.
+ *
+ * Output is one CSV line per data point:
+ * size,receivers,variant,create_us,fill_MB/s,fill_minflt,connect_p50_us,connect_max_us,
+ * prefault_p50_us,verify_p50_MB/s,verify_total_MB/s,minflt_p50,result
+ * Returns 1 if any receiver read wrong data.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shmheap.h"
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+
+#define MIN_SIZE (64 << 10)
+#define MAX_RECEIVERS 1000
+#define VERIFY_BUDGET (64ull << 30)
+#define NUM_VARIANTS 3
+
+enum { VARIANT_LAZY, VARIANT_POPULATE, VARIANT_HUGEPAGE };
+static const char *const variant_names[NUM_VARIANTS] = {"lazy", "populate", "hugepage"};
+
+// what each receiver reports back, in an anonymous shared mapping
+typedef struct {
+    int64_t connect_ns;
+    int64_t prefault_ns;
+    int64_t verify_ns;
+    long minflt;
+    int result; // 0 = ok, 1 = wrong data
+} receiver_stats;
+
+static const char *shm_prefix = "/shmheap";
+
+// names are /shmheap-<id>-<i>, as explained in grading-ex1/grader_ex1.c
+static const char *find_good_shm_name(int *i) {
+    static char run_id[48];
+    if (run_id[0] == '\0') {
+        const char *env = getenv("SHMHEAP_RUN_ID");
+        if (env != NULL && env[0] != '\0') {
+            snprintf(run_id, sizeof(run_id), "%s", env);
+        }
+        else {
+            unsigned int nonce = time(NULL);
+            const int fd = open("/dev/urandom", O_RDONLY);
+            if (fd != -1) {
+                read(fd, &nonce, sizeof(nonce));
+                close(fd);
+            }
+            snprintf(run_id, sizeof(run_id), "%d-%08x", (int)getpid(), nonce);
+        }
+    }
+    char *ret = malloc(80 * sizeof(char));
+    snprintf(ret, 80, "%s-%s-%d", shm_prefix, run_id, (*i)++);
+    return ret;
+}
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+static long minflt_now(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_minflt;
+}
+
+// word i of the object, cheap enough that verification runs at memory speed
+static uint64_t pattern_word(uint64_t seed, size_t i) {
+    uint64_t z = seed + (i + 1) * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    return z ^ (z >> 31);
+}
+
+// the page-aligned range covering [ptr, ptr + len), for madvise
+static void page_range(void *ptr, size_t len, long page_size, void **start, size_t *range) {
+    const uintptr_t begin = (uintptr_t)ptr & ~((uintptr_t)page_size - 1);
+    const uintptr_t end = ((uintptr_t)ptr + len + page_size - 1) & ~((uintptr_t)page_size - 1);
+    *start = (void*)begin;
+    *range = end - begin;
+}
+
+static int cmp_int64(const void *a, const void *b) {
+    const int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int64_t percentile(int64_t *values, int count, int pct) {
+    qsort(values, count, sizeof(int64_t), cmp_int64);
+    return values[(size_t)(count - 1) * pct / 100];
+}
+
+static int receiver_proc(const char *mem_name, shmheap_object_handle obj, size_t num_words, uint64_t seed, int variant, long page_size, receiver_stats *stats) {
+    const long flt = minflt_now();
+    int64_t t0 = now_ns();
+    shmheap_memory_handle mem = shmheap_connect(mem_name);
+    const uint64_t *data = shmheap_handle_to_ptr(mem, obj);
+    int64_t t1 = now_ns();
+    stats->connect_ns = t1 - t0;
+
+    void *start;
+    size_t range;
+    page_range((void*)data, num_words * sizeof(uint64_t), page_size, &start, &range);
+    t0 = now_ns();
+    if (variant == VARIANT_HUGEPAGE) {
+        madvise(start, range, MADV_HUGEPAGE);
+    }
+    else if (variant == VARIANT_POPULATE && madvise(start, range, MADV_POPULATE_READ) == -1) {
+        // older kernels: fault every page in by hand
+        volatile const char *p = start;
+        for (size_t off=0; off < range; off += page_size) (void)p[off];
+    }
+    t1 = now_ns();
+    stats->prefault_ns = t1 - t0;
+
+    int result = 0;
+    for (size_t i=0; i!=num_words; ++i) {
+        if (data[i] != pattern_word(seed, i)) {
+            result = 1;
+            break;
+        }
+    }
+    stats->verify_ns = now_ns() - t1;
+    stats->minflt = minflt_now() - flt;
+    stats->result = result;
+
+    shmheap_disconnect(mem);
+    return result;
+}
+
+// Runs one data point; returns 1 if a receiver read wrong data, -1 if the point could not be run.
+static int bench_point(int *name_idx, size_t size, int num_receivers, int variant, long page_size, receiver_stats *stats) {
+    const char *const mem_name = find_good_shm_name(name_idx);
+    const uint64_t seed = ((uint64_t)rand() << 32) ^ rand();
+
+    int64_t t0 = now_ns();
+    shmheap_memory_handle mem = shmheap_create(mem_name, size);
+    const int64_t create_ns = now_ns() - t0;
+
+    // one object taking all but a page of the heap, which is plenty for bookkeeping
+    const size_t num_words = (size - page_size) / sizeof(uint64_t);
+    uint64_t *const data = shmheap_alloc(mem, num_words * sizeof(uint64_t));
+    if (data == NULL) {
+        printf("%zu,%d,%s,allocation failed\n", size, num_receivers, variant_names[variant]);
+        fflush(stdout);
+        shmheap_destroy(mem_name, mem);
+        return -1;
+    }
+    if (variant == VARIANT_HUGEPAGE) {
+        void *start;
+        size_t range;
+        page_range(data, num_words * sizeof(uint64_t), page_size, &start, &range);
+        madvise(start, range, MADV_HUGEPAGE);
+    }
+    const long flt = minflt_now();
+    t0 = now_ns();
+    for (size_t i=0; i!=num_words; ++i) {
+        data[i] = pattern_word(seed, i);
+    }
+    const int64_t fill_ns = now_ns() - t0;
+    const long fill_minflt = minflt_now() - flt;
+    const shmheap_object_handle obj = shmheap_ptr_to_handle(mem, data);
+
+    // nothing buffered may be duplicated into the children
+    fflush(stdout);
+    memset(stats, 0, sizeof(receiver_stats) * num_receivers);
+    const int64_t start_ns = now_ns();
+    int spawned = 0;
+    for (; spawned!=num_receivers; ++spawned) {
+        const int res = fork();
+        if (res == -1) break;
+        if (res == 0) {
+            exit(receiver_proc(mem_name, obj, num_words, seed, variant, page_size, &stats[spawned]));
+        }
+    }
+    int errcode = 0;
+    for (int i=0; i!=spawned; ++i) {
+        int status;
+        if (wait(&status) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) errcode = 1;
+    }
+    const int64_t total_ns = now_ns() - start_ns;
+
+    shmheap_destroy(mem_name, mem);
+
+    if (spawned != num_receivers) {
+        printf("%zu,%d,%s,could only fork %d receivers\n", size, num_receivers, variant_names[variant], spawned);
+        fflush(stdout);
+        return -1;
+    }
+
+    int64_t *const values = malloc(sizeof(int64_t) * num_receivers);
+    for (int i=0; i!=num_receivers; ++i) values[i] = stats[i].connect_ns;
+    const int64_t connect_p50 = percentile(values, num_receivers, 50);
+    const int64_t connect_max = percentile(values, num_receivers, 100);
+    for (int i=0; i!=num_receivers; ++i) values[i] = stats[i].prefault_ns;
+    const int64_t prefault_p50 = percentile(values, num_receivers, 50);
+    for (int i=0; i!=num_receivers; ++i) values[i] = stats[i].verify_ns;
+    const int64_t verify_p50 = percentile(values, num_receivers, 50);
+    for (int i=0; i!=num_receivers; ++i) values[i] = stats[i].minflt;
+    const int64_t minflt_p50 = percentile(values, num_receivers, 50);
+    free(values);
+
+    const double bytes = (double)num_words * sizeof(uint64_t);
+    printf("%zu,%d,%s,%.1f,%.1f,%ld,%.1f,%.1f,%.1f,%.1f,%.1f,%lld,%s\n", size, num_receivers, variant_names[variant],
+        create_ns / 1e3, bytes * 1e3 / (fill_ns > 0 ? fill_ns : 1), fill_minflt,
+        connect_p50 / 1e3, connect_max / 1e3, prefault_p50 / 1e3,
+        bytes * 1e3 / (verify_p50 > 0 ? verify_p50 : 1), bytes * num_receivers * 1e3 / (total_ns > 0 ? total_ns : 1),
+        (long long)minflt_p50, errcode == 0 ? "ok" : "wrong data");
+    fflush(stdout);
+    return errcode;
+}
+
+static size_t parse_size(const char *str) {
+    char *end;
+    size_t size = strtoull(str, &end, 10);
+    switch (*end) {
+        case 'G': case 'g': size <<= 10; /* fallthrough */
+        case 'M': case 'm': size <<= 10; /* fallthrough */
+        case 'K': case 'k': size <<= 10;
+    }
+    return size;
+}
+
+// whether shmem can be backed by transparent huge pages at all
+static bool shmem_thp_available(void) {
+    char buf[128] = {0};
+    FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/shmem_enabled", "r");
+    if (f == NULL) return false;
+    fgets(buf, sizeof(buf), f);
+    fclose(f);
+    return strstr(buf, "[never]") == NULL && strstr(buf, "[deny]") == NULL;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "-h") == 0) {
+        printf("usage: %s [max_size=4G] [max_receivers=1000] [seed]\n", argv[0]);
+        return 1; // run failed
+    }
+    const size_t max_size = argc > 1 ? parse_size(argv[1]) : (size_t)4 << 30;
+    int max_receivers = argc > 2 ? atoi(argv[2]) : MAX_RECEIVERS;
+    if (max_receivers < 1 || max_receivers > MAX_RECEIVERS) max_receivers = MAX_RECEIVERS;
+    if (argc > 3) {
+        const int seed = atoi(argv[3]);
+        srand(seed ? seed : time(NULL));
+    }
+
+    const long page_size = sysconf(_SC_PAGESIZE);
+    receiver_stats *const stats = mmap(NULL, sizeof(receiver_stats) * MAX_RECEIVERS, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    assert(stats != MAP_FAILED);
+
+    const bool thp = shmem_thp_available();
+    if (!thp) {
+        printf("Shmem huge pages are disabled, the hugepage variant will use normal pages\n");
+    }
+
+    int name_idx = 0;
+    int errcode = 0;
+    printf("size,receivers,variant,create_us,fill_MB/s,fill_minflt,connect_p50_us,connect_max_us,prefault_p50_us,verify_p50_MB/s,verify_total_MB/s,minflt_p50,result\n");
+    fflush(stdout);
+    for (size_t size = MIN_SIZE; size <= max_size; size *= 4) {
+        struct statvfs vfs;
+        if (statvfs("/dev/shm", &vfs) == 0 && (size_t)vfs.f_bavail * vfs.f_frsize < size + (size >> 3)) {
+            printf("Skipping size %zu: not enough space in /dev/shm\n", size);
+            break;
+        }
+        for (int num_receivers = 1; ; num_receivers = num_receivers * 4 > max_receivers ? max_receivers : num_receivers * 4) {
+            if ((unsigned long long)size * num_receivers > VERIFY_BUDGET) {
+                printf("Skipping %d receivers of size %zu: over the verification budget\n", num_receivers, size);
+                break;
+            }
+            for (int variant=0; variant!=NUM_VARIANTS; ++variant) {
+                const int res = bench_point(&name_idx, size, num_receivers, variant, page_size, stats);
+                if (res == 1 && errcode == 0) errcode = 1;
+            }
+            if (num_receivers == max_receivers) break;
+        }
+    }
+
+    munmap(stats, sizeof(receiver_stats) * MAX_RECEIVERS);
+    return errcode;
+}
@@ -2,15 +2,30 @@
  * This runner tests ex1 by creating a shared heap,
  * allocating one object in it, and sending it to
  * `num_receiver_processes` other processes via a pipe.
+ * Children do not print their results; they append them to a per-child log tagged with the
+ * index of the instruction, and the parent writes the merged transcript at the end.
+ * Set SHMHEAP_TRACE=path for a timeline of the shmheap calls, or SHMHEAP_PERF=path
+ * for their perf counters (see grader_trace.h, which lives in grading-ex3 and is shared
+ * with grader_ex3: script.sh copies both directories into the stage, and other builds
+ * need -I../grading-ex3).
+ *
+ * With `first_space mid_space` as arguments, the grader also runs the first-fit
+ * model of dynspace-ex2 alongside, and every child checks the offsets it gets
+ * and the values it reads against it as they arrive. At the first difference the
+ * child exits, the parent stops sending instructions and exits with 1 after
+ * printing the index of the instruction, so a wrong run stops after its correct prefix.
  */
 
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -19,6 +34,7 @@
 #include <unistd.h>
 
 #include "shmheap.h"
+#include "grader_trace.h"
 
 #define SHMHEAP_CONNECT 0
 #define SHMHEAP_DISCONNECT 1
@@ -34,28 +50,211 @@ typedef struct {
     pipe_pair in, out;
 } bidir_pipe;
 
+// A child's transcript lines live in a memfd that starts with the number of bytes of complete
+// records, followed by the records: a log_record, then len bytes of text.
+typedef struct {
+    size_t seq;
+    size_t len;
+} log_record;
+
+typedef struct {
+    int fd;
+    char *mem;
+    size_t cap;
+    size_t pos; // end of the record being written
+    size_t record; // start of the record being written
+} child_log;
+
+#define LOG_INITIAL_CAP (1 << 16)
+
+// A block of the first-fit model in simulate.cpp: len words including the mid_space-word header.
+typedef struct {
+    size_t len;
+    bool used;
+} model_chunk;
+
+// The heap as dynspace-ex2 sees it; offsets are in words past front_space.
+typedef struct {
+    model_chunk *chunks;
+    size_t num_chunks;
+    size_t mid_space; // in words
+    size_t front_space; // in bytes, as in simulate.cpp: first_space - mid_space
+} heap_model;
+
+static bool verify; // set before forking, so the children see it too
+
 static const char *shm_prefix = "/shmheap";
 
+// names are /shmheap-<id>-<i>, as explained in grading-ex1/grader_ex1.c
 static const char *find_good_shm_name(int *i) {
-    char *ret = malloc(20 * sizeof(char));
-    memcpy(ret, shm_prefix, strlen(shm_prefix));
-    while (true) {
-        sprintf(ret + strlen(shm_prefix), "%d", (*i)++);
-        int fd;
-        if ((fd = shm_open(ret, O_RDWR, 0)) == -1) {
-            if (errno == ENOENT) return ret;
-            else if (errno == EINVAL || errno == EMFILE || errno == ENAMETOOLONG || errno == ENFILE) {
-                printf("Unexpected error\n");
-                exit(EXIT_FAILURE);
-            }
+    static char run_id[48];
+    if (run_id[0] == '\0') {
+        const char *env = getenv("SHMHEAP_RUN_ID");
+        if (env != NULL && env[0] != '\0') {
+            snprintf(run_id, sizeof(run_id), "%s", env);
         }
         else {
-            close(fd);
+            unsigned int nonce = time(NULL);
+            const int fd = open("/dev/urandom", O_RDONLY);
+            if (fd != -1) {
+                read(fd, &nonce, sizeof(nonce));
+                close(fd);
+            }
+            snprintf(run_id, sizeof(run_id), "%d-%08x", (int)getpid(), nonce);
+        }
+    }
+    char *ret = malloc(80 * sizeof(char));
+    snprintf(ret, 80, "%s-%s-%d", shm_prefix, run_id, (*i)++);
+    return ret;
+}
+
+// allocate_obj of simulate.cpp, returning the byte offset from the base, or SIZE_MAX if nothing fits
+static size_t model_alloc(heap_model *m, size_t len) {
+    len += m->mid_space;
+    size_t offset = 0;
+    for (size_t i=0; i!=m->num_chunks; ++i) {
+        model_chunk *c = &m->chunks[i];
+        if (!c->used && c->len >= len) {
+            if (c->len >= len + m->mid_space) {
+                memmove(c + 2, c + 1, sizeof(model_chunk) * (m->num_chunks - i - 1));
+                c[1].len = c->len - len;
+                c[1].used = false;
+                c->len = len;
+                ++m->num_chunks;
+            }
+            c->used = true;
+            return (offset + m->mid_space) * sizeof(size_t) + m->front_space;
         }
+        offset += c->len;
+    }
+    return SIZE_MAX;
+}
+
+// free_obj of simulate.cpp, merging with free neighbours
+static void model_free(heap_model *m, size_t byte_offset) {
+    const size_t idx = (byte_offset - m->front_space) / sizeof(size_t) - m->mid_space;
+    size_t offset = 0;
+    size_t i = 0;
+    while (offset != idx) {
+        assert(i != m->num_chunks);
+        offset += m->chunks[i++].len;
+    }
+    m->chunks[i].used = false;
+    if (i + 1 != m->num_chunks && !m->chunks[i + 1].used) {
+        m->chunks[i].len += m->chunks[i + 1].len;
+        memmove(&m->chunks[i + 1], &m->chunks[i + 2], sizeof(model_chunk) * (m->num_chunks - i - 2));
+        --m->num_chunks;
+    }
+    if (i != 0 && !m->chunks[i - 1].used) {
+        m->chunks[i - 1].len += m->chunks[i].len;
+        memmove(&m->chunks[i], &m->chunks[i + 1], sizeof(model_chunk) * (m->num_chunks - i - 1));
+        --m->num_chunks;
+    }
+}
+
+// In verify mode the parent sends one more word with an instruction: the offset it must
+// get (alloc, free) or the first value it must read (read).
+static size_t read_expected(int input_fd) {
+    size_t expected = 0;
+    if (verify) {
+        const int res = read(input_fd, &expected, sizeof(expected));
+        assert(res == sizeof(expected));
     }
+    return expected;
 }
 
-static int child_proc(const bidir_pipe *bp, const char *mem_name, int child_idx, const char *dummy_name, long page_size) {
+static void log_reserve(child_log *log, size_t extra) {
+    if (log->pos + extra <= log->cap) return;
+    size_t cap = log->cap * 2;
+    while (cap < log->pos + extra) cap *= 2;
+    if (ftruncate(log->fd, cap) == -1) exit(98);
+    log->mem = mremap(log->mem, log->cap, cap, MREMAP_MAYMOVE);
+    if (log->mem == MAP_FAILED) exit(98);
+    log->cap = cap;
+}
+
+static void log_begin(child_log *log, size_t seq) {
+    log_reserve(log, sizeof(log_record));
+    log->record = log->pos;
+    memcpy(log->mem + log->record, &seq, sizeof(seq));
+    log->pos += sizeof(log_record);
+}
+
+static void log_printf(child_log *log, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(log->mem + log->pos, log->cap - log->pos, format, args);
+    va_end(args);
+    if (log->pos + len >= log->cap) {
+        log_reserve(log, len + 1);
+        va_start(args, format);
+        vsnprintf(log->mem + log->pos, log->cap - log->pos, format, args);
+        va_end(args);
+    }
+    log->pos += len;
+}
+
+// makes the record visible to the parent
+static void log_end(child_log *log) {
+    const size_t len = log->pos - log->record - sizeof(log_record);
+    memcpy(log->mem + log->record + offsetof(log_record, len), &len, sizeof(len));
+    memcpy(log->mem, &log->pos, sizeof(log->pos));
+}
+
+// ends the record and reports the difference by exiting, which the parent sees as a missing reply
+static void diverged(child_log *log) {
+    log_end(log);
+    exit(1);
+}
+
+// Writes the records of all logs to stdout in instruction order; each log is already in order.
+static void write_transcript(const int *log_fds, int num_proc) {
+    char **mems = malloc(sizeof(char*) * num_proc);
+    size_t *ends = malloc(sizeof(size_t) * num_proc);
+    size_t *cursors = malloc(sizeof(size_t) * num_proc);
+    for (int i=0; i!=num_proc; ++i) {
+        struct stat st;
+        mems[i] = NULL;
+        ends[i] = cursors[i] = sizeof(size_t);
+        if (fstat(log_fds[i], &st) == -1 || (size_t)st.st_size < sizeof(size_t)) continue;
+        mems[i] = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, log_fds[i], 0);
+        if (mems[i] == MAP_FAILED) {
+            mems[i] = NULL;
+            continue;
+        }
+        memcpy(&ends[i], mems[i], sizeof(size_t));
+        // nothing committed yet, or the child scribbled over its log
+        if (ends[i] < sizeof(size_t) || ends[i] > (size_t)st.st_size) ends[i] = sizeof(size_t);
+    }
+    while (true) {
+        int next = -1;
+        size_t next_seq = 0;
+        for (int i=0; i!=num_proc; ++i) {
+            if (cursors[i] == ends[i]) continue;
+            size_t seq;
+            memcpy(&seq, mems[i] + cursors[i], sizeof(seq));
+            if (next == -1 || seq < next_seq) {
+                next = i;
+                next_seq = seq;
+            }
+        }
+        if (next == -1) break;
+        log_record rec;
+        memcpy(&rec, mems[next] + cursors[next], sizeof(rec));
+        fwrite(mems[next] + cursors[next] + sizeof(rec), 1, rec.len, stdout);
+        cursors[next] += sizeof(rec) + rec.len;
+    }
+    fflush(stdout);
+    for (int i=0; i!=num_proc; ++i) {
+        struct stat st;
+        if (mems[i] != NULL && fstat(log_fds[i], &st) != -1) munmap(mems[i], st.st_size);
+    }
+    free(cursors);
+    free(ends);
+    free(mems);
+}
+
+static int child_proc(const bidir_pipe *bp, int log_fd, const char *mem_name, int child_idx, const char *dummy_name, long page_size) {
     // allocate some shared mem just to block out the heap space
     int fd2 = shm_open(dummy_name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
     ftruncate(fd2, page_size * (child_idx + 1));
@@ -66,23 +265,39 @@ static int child_proc(const bidir_pipe *bp, const char *mem_name, int child_idx,
     void *base;
     int input_fd = bp->in.fd[0];
     int output_fd = bp->out.fd[1];
+    bool connected = false;
     int res;
     int type;
+    size_t seq;
+    trace_call tc;
+    child_log log = {log_fd, NULL, LOG_INITIAL_CAP, sizeof(size_t), 0};
+    if (ftruncate(log_fd, log.cap) == -1) return 98;
+    log.mem = mmap(NULL, log.cap, PROT_READ | PROT_WRITE, MAP_SHARED, log_fd, 0);
+    if (log.mem == MAP_FAILED) return 98;
     while (read(input_fd, &type, sizeof(type)) == sizeof(type)) {
+        res = read(input_fd, &seq, sizeof(seq));
+        assert(res == sizeof(seq));
+        log_begin(&log, seq);
         switch (type) {
             case SHMHEAP_CONNECT: {
+                tc = trace_begin(child_idx, TRACE_CONNECT);
                 mem = shmheap_connect(mem_name);
+                trace_end(&tc);
                 base = shmheap_underlying(mem);
-                printf("#%d: Connected\n", child_idx);
-                fflush(stdout);
+                connected = true;
+                log_printf(&log, "#%d: Connected\n", child_idx);
+                log_end(&log);
                 char dummy = 0;
                 write(output_fd, &dummy, sizeof(dummy));
                 break;
             }
             case SHMHEAP_DISCONNECT: {
+                tc = trace_begin(child_idx, TRACE_DISCONNECT);
                 shmheap_disconnect(mem);
-                printf("#%d: Disconnected\n", child_idx);
-                fflush(stdout);
+                trace_end(&tc);
+                connected = false;
+                log_printf(&log, "#%d: Disconnected\n", child_idx);
+                log_end(&log);
                 char dummy = 0;
                 write(output_fd, &dummy, sizeof(dummy));
                 break;
@@ -94,13 +309,19 @@ static int child_proc(const bidir_pipe *bp, const char *mem_name, int child_idx,
                 assert(res == sizeof(hdl));
                 res = read(input_fd, &count, sizeof(count));
                 assert(res == sizeof(count));
+                const size_t first = read_expected(input_fd);
+                tc = trace_begin(child_idx, TRACE_HANDLE_TO_PTR);
                 size_t *data = (size_t*)shmheap_handle_to_ptr(mem, hdl);
-                printf("#%d: Read:", child_idx);
+                trace_end(&tc);
+                bool ok = true;
+                log_printf(&log, "#%d: Read:", child_idx);
                 for (size_t i=0; i!=count; ++i) {
-                    printf(" %zu", data[i]);
+                    log_printf(&log, " %zu", data[i]);
+                    if (data[i] != first + i) ok = false;
                 }
-                printf("\n");
-                fflush(stdout);
+                log_printf(&log, "\n");
+                if (verify && !ok) diverged(&log);
+                log_end(&log);
                 char dummy = 0;
                 write(output_fd, &dummy, sizeof(dummy));
                 break;
@@ -112,14 +333,22 @@ static int child_proc(const bidir_pipe *bp, const char *mem_name, int child_idx,
                 assert(res == sizeof(first));
                 res = read(input_fd, &count, sizeof(count));
                 assert(res == sizeof(count));
+                const size_t expected = read_expected(input_fd);
+                tc = trace_begin(child_idx, TRACE_ALLOC);
                 size_t *data = (size_t*)shmheap_alloc(mem, sizeof(size_t) * count);
-                printf("#%d: Allocated at offset %zu:", child_idx, (char*)data - (char*)base);
+                trace_end(&tc);
+                log_printf(&log, "#%d: Allocated at offset %zu:", child_idx, (char*)data - (char*)base);
+                if (verify && (data == NULL || (size_t)((char*)data - (char*)base) != expected)) {
+                    // do not write through a pointer that may be outside the object
+                    log_printf(&log, "\n");
+                    diverged(&log);
+                }
                 for (size_t i=0; i!=count; ++i) {
                     data[i] = first++;
-                    printf(" %zu", data[i]);
+                    log_printf(&log, " %zu", data[i]);
                 }
-                printf("\n");
-                fflush(stdout);
+                log_printf(&log, "\n");
+                log_end(&log);
                 shmheap_object_handle hdl = shmheap_ptr_to_handle(mem, data);
                 write(output_fd, &hdl, sizeof(hdl));
                 break;
@@ -128,10 +357,19 @@ static int child_proc(const bidir_pipe *bp, const char *mem_name, int child_idx,
                 shmheap_object_handle hdl;
                 res = read(input_fd, &hdl, sizeof(hdl));
                 assert(res == sizeof(hdl));
+                const size_t expected = read_expected(input_fd);
+                tc = trace_begin(child_idx, TRACE_HANDLE_TO_PTR);
                 size_t *data = (size_t*)shmheap_handle_to_ptr(mem, hdl);
+                trace_end(&tc);
+                if (verify && (size_t)((char*)data - (char*)base) != expected) {
+                    log_printf(&log, "#%d: Freed at offset: %zu\n", child_idx, (char*)data - (char*)base);
+                    diverged(&log);
+                }
+                tc = trace_begin(child_idx, TRACE_FREE);
                 shmheap_free(mem, data);
-                printf("#%d: Freed at offset: %zu\n", child_idx, (char*)data - (char*)base);
-                fflush(stdout);
+                trace_end(&tc);
+                log_printf(&log, "#%d: Freed at offset: %zu\n", child_idx, (char*)data - (char*)base);
+                log_end(&log);
                 char dummy = 0;
                 write(output_fd, &dummy, sizeof(dummy));
                 break;
@@ -139,8 +377,10 @@ static int child_proc(const bidir_pipe *bp, const char *mem_name, int child_idx,
         }
     }
     
-    // check if the memory is really unmapped
-    if (mprotect(base, page_size * (child_idx + 1), PROT_NONE) != -1) {
+    munmap(log.mem, log.cap);
+    
+    // check if the memory is really unmapped; a child still connected was cut off by an early stop
+    if (!connected && mprotect(base, page_size * (child_idx + 1), PROT_NONE) != -1) {
         return 3;
     }
     
@@ -151,13 +391,23 @@ static int child_proc(const bidir_pipe *bp, const char *mem_name, int child_idx,
 }
 
 static ssize_t checked_write(int fd, const void *buf, size_t count, int *errcode) {
-    if (write(fd, buf, count) == -1 && errno != EPIPE) {
+    ssize_t res;
+    while ((res = write(fd, buf, count)) == -1 && errno == EINTR) trace_check_stop();
+    if (res == -1 && errno != EPIPE) {
         printf("Write failed\n");
         if (*errcode == 0) *errcode = 98;
     }
+    return res;
+}
+
+// reads one reply of `count` bytes, returning false if the child is gone (it crashed, or diverged)
+static bool await_reply(int fd, void *buf, size_t count) {
+    ssize_t res;
+    while ((res = read(fd, buf, count)) == -1 && errno == EINTR) trace_check_stop();
+    return res == (ssize_t)count;
 }
 
-int main () {
+int main (int argc, char** argv) {
     // silence sigpipe (might happen if the child died)
     struct sigaction tmp_sa = {SIG_IGN};
     sigaction(SIGPIPE, &tmp_sa, NULL);
@@ -175,6 +425,23 @@ int main () {
     assert(num_proc > 0);
     assert(num_objects > 0);
     
+    // the heap as simulate.cpp lays it out, with its 256 bytes of allowance at the end
+    heap_model model = {NULL, 0, 0, 0};
+    if (argc > 2) {
+        size_t first_space, mid_space;
+        sscanf(argv[1], "%zu", &first_space);
+        sscanf(argv[2], "%zu", &mid_space);
+        assert(first_space % sizeof(size_t) == 0 && mid_space % sizeof(size_t) == 0 && first_space >= mid_space);
+        model.front_space = first_space - mid_space;
+        model.mid_space = mid_space / sizeof(size_t);
+        // every alloc splits off at most one more chunk
+        model.chunks = malloc(sizeof(model_chunk) * (2 * (size_t)num_objects + 2));
+        model.chunks[0].len = (mem_size - model.front_space - 256) / sizeof(size_t);
+        model.chunks[0].used = false;
+        model.num_chunks = 1;
+        verify = true;
+    }
+    
     size_t start_index = 0;
 
     int i = 0;
@@ -185,57 +452,78 @@ int main () {
     // find a name for our dummy shm heap
     const char *const dummy_name = find_good_shm_name(&i);
     
-    // create pipes
+    // create pipes and logs
     bidir_pipe *const pp = malloc(sizeof(bidir_pipe) * num_proc);
+    int *const log_fds = malloc(sizeof(int) * num_proc);
+
+    trace_init(num_proc);
     
     // spawn children
     for (int i=0; i!=num_proc; ++i) {
         pipe2(pp[i].in.fd, O_DIRECT);
         pipe2(pp[i].out.fd, O_DIRECT);
+        log_fds[i] = memfd_create("shmheap_transcript", 0);
+        assert(log_fds[i] != -1);
         int res = fork();
         assert(res != -1);
         if (res == 0) {
             for (int j=0; j!=i; ++j) {
                 close(pp[j].in.fd[1]);
                 close(pp[j].out.fd[0]);
+                close(log_fds[j]);
             }
             close(pp[i].in.fd[1]);
             close(pp[i].out.fd[0]);
             const bidir_pipe curr_pp = pp[i];
+            const int log_fd = log_fds[i];
             free(pp);
-            return child_proc(&curr_pp, mem_name, i, dummy_name, page_size);
+            free(log_fds);
+            trace_child_started();
+            return child_proc(&curr_pp, log_fd, mem_name, i, dummy_name, page_size);
         }
         close(pp[i].in.fd[0]);
         close(pp[i].out.fd[1]);
     }
     
     // init the shm heap
+    trace_call tc = trace_begin(num_proc, TRACE_CREATE);
     shmheap_memory_handle mem = shmheap_create(mem_name, mem_size);
+    trace_end(&tc);
     
     void *const base = shmheap_underlying(mem);
     
     // store objects and sizes
     shmheap_object_handle *objects_arr = malloc(sizeof(shmheap_object_handle) * num_objects);
     size_t *sizes_arr = malloc(sizeof(size_t) * num_objects);
+    // in verify mode, the offset the model gave each object and the first value written to it
+    size_t *offsets_arr = malloc(sizeof(size_t) * num_objects);
+    size_t *firsts_arr = malloc(sizeof(size_t) * num_objects);
     
     int errcode = 0;
     
-    // read the input
+    // read the input; in verify mode, stop at the first instruction that gets no reply, as its
+    // child has diverged from the model
     int type, index;
-    while (scanf("%d%d", &type, &index) == 2) {
+    size_t seq = 0;
+    size_t stopped_at = 0;
+    while (stopped_at == 0 && scanf("%d%d", &type, &index) == 2) {
         assert(0 <= type && type < 5);
         assert(0 <= index && index < num_proc);
+        // every instruction is sent as its type, then its index in the transcript, then its arguments
+        ++seq;
         switch (type) {
             case SHMHEAP_CONNECT: {
                 checked_write(pp[index].in.fd[1], &type, sizeof(type), &errcode);
+                checked_write(pp[index].in.fd[1], &seq, sizeof(seq), &errcode);
                 char dummy;
-                read(pp[index].out.fd[0], &dummy, sizeof(dummy));
+                if (!await_reply(pp[index].out.fd[0], &dummy, sizeof(dummy)) && verify) stopped_at = seq;
                 break;
             }
             case SHMHEAP_DISCONNECT: {
                 checked_write(pp[index].in.fd[1], &type, sizeof(type), &errcode);
+                checked_write(pp[index].in.fd[1], &seq, sizeof(seq), &errcode);
                 char dummy;
-                read(pp[index].out.fd[0], &dummy, sizeof(dummy));
+                if (!await_reply(pp[index].out.fd[0], &dummy, sizeof(dummy)) && verify) stopped_at = seq;
                 break;
             }
             case SHMHEAP_READ: {
@@ -243,10 +531,12 @@ int main () {
                 scanf("%d", &id);
                 assert(0 <= id && id < num_objects);
                 checked_write(pp[index].in.fd[1], &type, sizeof(type), &errcode);
+                checked_write(pp[index].in.fd[1], &seq, sizeof(seq), &errcode);
                 checked_write(pp[index].in.fd[1], &objects_arr[id], sizeof(objects_arr[id]), &errcode);
                 checked_write(pp[index].in.fd[1], &sizes_arr[id], sizeof(sizes_arr[id]), &errcode);
+                if (verify) checked_write(pp[index].in.fd[1], &firsts_arr[id], sizeof(firsts_arr[id]), &errcode);
                 char dummy;
-                read(pp[index].out.fd[0], &dummy, sizeof(dummy));
+                if (!await_reply(pp[index].out.fd[0], &dummy, sizeof(dummy)) && verify) stopped_at = seq;
                 break;
             }
             case SHMHEAP_ALLOC: {
@@ -255,11 +545,18 @@ int main () {
                 scanf("%d%zu", &id, &sz);
                 assert(0 <= id && id < num_objects);
                 checked_write(pp[index].in.fd[1], &type, sizeof(type), &errcode);
+                checked_write(pp[index].in.fd[1], &seq, sizeof(seq), &errcode);
                 checked_write(pp[index].in.fd[1], &start_index, sizeof(start_index), &errcode);
                 checked_write(pp[index].in.fd[1], &sz, sizeof(sz), &errcode);
+                if (verify) {
+                    offsets_arr[id] = model_alloc(&model, sz);
+                    assert(offsets_arr[id] != SIZE_MAX); // the generator only emits allocations that fit
+                    checked_write(pp[index].in.fd[1], &offsets_arr[id], sizeof(offsets_arr[id]), &errcode);
+                }
+                firsts_arr[id] = start_index;
                 start_index += sz;
                 shmheap_object_handle hdl;
-                read(pp[index].out.fd[0], &hdl, sizeof(hdl));
+                if (!await_reply(pp[index].out.fd[0], &hdl, sizeof(hdl)) && verify) stopped_at = seq;
                 objects_arr[id] = hdl;
                 sizes_arr[id] = sz;
                 break;
@@ -269,16 +566,24 @@ int main () {
                 scanf("%d", &id);
                 assert(0 <= id && id < num_objects);
                 checked_write(pp[index].in.fd[1], &type, sizeof(type), &errcode);
+                checked_write(pp[index].in.fd[1], &seq, sizeof(seq), &errcode);
                 checked_write(pp[index].in.fd[1], &objects_arr[id], sizeof(objects_arr[id]), &errcode);
+                if (verify) {
+                    checked_write(pp[index].in.fd[1], &offsets_arr[id], sizeof(offsets_arr[id]), &errcode);
+                    model_free(&model, offsets_arr[id]);
+                }
                 char dummy;
-                read(pp[index].out.fd[0], &dummy, sizeof(dummy));
+                if (!await_reply(pp[index].out.fd[0], &dummy, sizeof(dummy)) && verify) stopped_at = seq;
                 break;
             }
         }
     }
     
+    free(firsts_arr);
+    free(offsets_arr);
     free(sizes_arr);
     free(objects_arr);
+    free(model.chunks);
 
     // close the input pipes, so that the children will terminate
     for (int i=0; i!=num_proc; ++i) {
@@ -287,11 +592,23 @@ int main () {
     
     free(pp);
 
-    // wait for children
+    // wait for children, keeping their statuses until the transcript is written
+    int *const pids = malloc(sizeof(int) * num_proc);
+    int *const statuses = malloc(sizeof(int) * num_proc);
     for (int i=0; i!=num_proc; ++i) {
-        int status;
-        int pid;
-        if ((pid = wait(&status)) == -1) {
+        while ((pids[i] = wait(&statuses[i])) == -1 && errno == EINTR) trace_check_stop();
+    }
+    
+    write_transcript(log_fds, num_proc);
+    for (int i=0; i!=num_proc; ++i) {
+        close(log_fds[i]);
+    }
+    free(log_fds);
+    
+    for (int i=0; i!=num_proc; ++i) {
+        const int pid = pids[i];
+        const int status = statuses[i];
+        if (pid == -1) {
             printf("Child mysteriously disappeared\n");
             if (errcode == 0) errcode = 4;
         }
@@ -303,6 +620,10 @@ int main () {
             printf("Child [pid = %d] terminated abruptly!\n", pid);
             if (errcode == 0) errcode = 8;
         }
+        else if(verify && WEXITSTATUS(status) == 1) {
+            printf("Wrong result at instruction %zu\n", stopped_at);
+            if (errcode == 0) errcode = 1;
+        }
         else if(WEXITSTATUS(status) == 3) {
             printf("Shared memory was not unmapped by shmheap_disconnect()\n");
             if (errcode == 0) errcode = 3;
@@ -315,9 +636,13 @@ int main () {
             // success... keep quiet
         }
     }
+    free(statuses);
+    free(pids);
     
     // destroy shm
+    tc = trace_begin(num_proc, TRACE_DESTROY);
     shmheap_destroy(mem_name, mem);
+    trace_end(&tc);
     
     shm_unlink(dummy_name);
     
@@ -326,6 +651,8 @@ int main () {
         printf("Shared memory was not unmapped by shmheap_destroy()\n");
         if (errcode == 0) errcode = 5;
     }
+
+    trace_write();
     
     return errcode;
 }
@@ -36,23 +36,27 @@ typedef struct {
 
 static const char *shm_prefix = "/shmheap";
 
+// names are /shmheap-<id>-<i>, as explained in grading-ex1/grader_ex1.c
 static const char *find_good_shm_name(int *i) {
-    char *ret = malloc(20 * sizeof(char));
-    memcpy(ret, shm_prefix, strlen(shm_prefix));
-    while (true) {
-        sprintf(ret + strlen(shm_prefix), "%d", (*i)++);
-        int fd;
-        if ((fd = shm_open(ret, O_RDWR, 0)) == -1) {
-            if (errno == ENOENT) return ret;
-            else if (errno == EINVAL || errno == EMFILE || errno == ENAMETOOLONG || errno == ENFILE) {
-                printf("Unexpected error\n");
-                exit(EXIT_FAILURE);
-            }
+    static char run_id[48];
+    if (run_id[0] == '\0') {
+        const char *env = getenv("SHMHEAP_RUN_ID");
+        if (env != NULL && env[0] != '\0') {
+            snprintf(run_id, sizeof(run_id), "%s", env);
         }
         else {
-            close(fd);
+            unsigned int nonce = time(NULL);
+            const int fd = open("/dev/urandom", O_RDONLY);
+            if (fd != -1) {
+                read(fd, &nonce, sizeof(nonce));
+                close(fd);
+            }
+            snprintf(run_id, sizeof(run_id), "%d-%08x", (int)getpid(), nonce);
         }
     }
+    char *ret = malloc(80 * sizeof(char));
+    snprintf(ret, 80, "%s-%s-%d", shm_prefix, run_id, (*i)++);
+    return ret;
 }
 
 static int child_proc(const bidir_pipe *bp, const char *mem_name, int child_idx, long page_size) {
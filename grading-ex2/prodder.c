@@ -20,24 +20,28 @@
 
 #include "shmheap.h"
 
-static char shm_name_store[20]="/shmheap";
+static char shm_name_store[80];
 
+// names are /shmheap-<id>-<i>, as explained in grading-ex1/grader_ex1.c
 static const char *find_good_shm_name(int *i) {
-    for (; true; ++*i){
-        sprintf(shm_name_store+8, "%d", *i);
-        //itoa(i, shm_name_store+8, 10);
-        int fd;
-        if ((fd = shm_open(shm_name_store, O_RDWR, 0)) == -1) {
-            if (errno == ENOENT) return shm_name_store;
-            else if (errno == EINVAL || errno == EMFILE || errno == ENAMETOOLONG || errno == ENFILE) {
-                printf("Unexpected error\n");
-                exit(EXIT_FAILURE);
-            }
+    static char run_id[48];
+    if (run_id[0] == '\0') {
+        const char *env = getenv("SHMHEAP_RUN_ID");
+        if (env != NULL && env[0] != '\0') {
+            snprintf(run_id, sizeof(run_id), "%s", env);
         }
         else {
-            close(fd);
+            unsigned int nonce = time(NULL);
+            const int fd = open("/dev/urandom", O_RDONLY);
+            if (fd != -1) {
+                read(fd, &nonce, sizeof(nonce));
+                close(fd);
+            }
+            snprintf(run_id, sizeof(run_id), "%d-%08x", (int)getpid(), nonce);
         }
     }
+    snprintf(shm_name_store, sizeof(shm_name_store), "/shmheap-%s-%d", run_id, (*i)++);
+    return shm_name_store;
 }
 
 int main (int argc, char** argv) {
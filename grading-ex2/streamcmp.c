@@ -0,0 +1,146 @@
+/**
+ * Compares streams (usually pipes) with a reference stream while they are
+ * still being written, like `cmp` but without needing any of them on disk:
+ *   streamcmp [-s] reference other...
+ * All inputs are read at once with poll(), so a producer that writes its
+ * output only at the end (grader_ex2) cannot stall one that writes as it goes
+ * (gen2). Only the part of the reference that some other stream has not
+ * reached yet is kept in memory. Every input is read to its end, so the
+ * producers are never killed by SIGPIPE and their exit codes stay meaningful.
+ *
+ * Exits with 0 if every other stream equals the reference, with the
+ * (1-based) position of the first other stream that differs otherwise, and
+ * with 255 if an input cannot be opened or read. Unless -s is given, every
+ * difference is reported on stdout, much like cmp does.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHUNK (1 << 16)
+
+typedef struct {
+    const char *name;
+    int fd; // -1 once at its end
+    char *buf; // bytes [start, start + len) of the stream
+    size_t cap, len;
+    uint64_t start;
+    uint64_t line; // line number at start
+    bool differs;
+} stream;
+
+static void append(stream *s, const char *data, size_t n) {
+    if (s->len + n > s->cap) {
+        while (s->len + n > s->cap) s->cap = s->cap == 0 ? CHUNK : s->cap * 2;
+        s->buf = realloc(s->buf, s->cap);
+        if (s->buf == NULL) exit(255);
+    }
+    memcpy(s->buf + s->len, data, n);
+    s->len += n;
+}
+
+// drops the first n bytes of the buffer
+static void consume(stream *s, size_t n) {
+    for (size_t i=0; i!=n; ++i) {
+        if (s->buf[i] == '\n') ++s->line;
+    }
+    memmove(s->buf, s->buf + n, s->len - n);
+    s->len -= n;
+    s->start += n;
+}
+
+// Compares as much of `other` as the reference has, consuming what matched.
+static void compare(const stream *ref, stream *other, bool silent) {
+    if (other->differs) return;
+    // the reference is never trimmed past a stream that has not differed yet
+    const size_t from = other->start - ref->start;
+    const size_t n = ref->len - from < other->len ? ref->len - from : other->len;
+    for (size_t i=0; i!=n; ++i) {
+        if (ref->buf[from + i] != other->buf[i]) {
+            consume(other, i);
+            other->differs = true;
+            if (!silent) printf("%s %s differ: byte %llu, line %llu\n", ref->name, other->name, (unsigned long long)other->start + 1, (unsigned long long)other->line + 1);
+            return;
+        }
+    }
+    consume(other, n);
+    // one stream ended where the other goes on
+    if ((ref->fd == -1 && other->len != 0) || (other->fd == -1 && ref->len != from + n)) {
+        other->differs = true;
+        if (!silent) printf("streamcmp: EOF on %s after byte %llu, line %llu\n", ref->fd == -1 && other->len != 0 ? ref->name : other->name, (unsigned long long)other->start, (unsigned long long)other->line);
+    }
+}
+
+int main(int argc, char **argv) {
+    bool silent = false;
+    int first = 1;
+    if (argc > 1 && strcmp(argv[1], "-s") == 0) {
+        silent = true;
+        ++first;
+    }
+    const int n = argc - first;
+    if (n < 2) {
+        printf("usage: %s [-s] reference other...\n", argv[0]);
+        return 255;
+    }
+    stream *streams = calloc(n, sizeof(stream));
+    struct pollfd *fds = calloc(n, sizeof(struct pollfd));
+    // opening a FIFO blocks until its writer opens it too
+    for (int i=0; i!=n; ++i) {
+        streams[i].name = argv[first + i];
+        streams[i].fd = open(argv[first + i], O_RDONLY);
+        if (streams[i].fd == -1) {
+            fprintf(stderr, "streamcmp: %s: %s\n", argv[first + i], strerror(errno));
+            return 255;
+        }
+    }
+
+    stream *const ref = &streams[0];
+    char chunk[CHUNK];
+    int open_count = n;
+    while (open_count != 0) {
+        for (int i=0; i!=n; ++i) {
+            fds[i].fd = streams[i].fd;
+            fds[i].events = POLLIN;
+        }
+        if (poll(fds, n, -1) == -1) {
+            if (errno == EINTR) continue;
+            return 255;
+        }
+        for (int i=0; i!=n; ++i) {
+            if (fds[i].revents == 0) continue;
+            const ssize_t got = read(streams[i].fd, chunk, sizeof(chunk));
+            if (got == -1) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                return 255;
+            }
+            if (got == 0) {
+                close(streams[i].fd);
+                streams[i].fd = -1;
+                --open_count;
+            }
+            // nothing more of a stream that differs is needed, only its end
+            else if (!streams[i].differs) {
+                append(&streams[i], chunk, got);
+            }
+        }
+        uint64_t keep_from = ref->start + ref->len;
+        for (int i=1; i!=n; ++i) {
+            compare(ref, &streams[i], silent);
+            if (!streams[i].differs && streams[i].start < keep_from) keep_from = streams[i].start;
+        }
+        consume(ref, keep_from - ref->start);
+    }
+
+    for (int i=1; i!=n; ++i) {
+        if (streams[i].differs) return i;
+    }
+    return 0;
+}
@@ -0,0 +1,218 @@
+/**
+ * Optional pinning of the children of the concurrent graders and benchmarks
+ * to CPUs, so that contention results do not depend on where the scheduler
+ * happens to put them.
+ *
+ * SHMHEAP_PLACEMENT=pattern picks where child i runs, out of the CPUs the
+ * grader is allowed to use, with the topology read from sysfs:
+ *   none       - not pinned, the kernel decides (the default)
+ *   packed     - the first core complex (CPUs sharing an L3 cache), one
+ *                thread per core before any SMT siblings
+ *   spread     - round robin over sockets, then core complexes, then cores,
+ *                with SMT siblings last
+ *   smt        - both SMT siblings of a core before the next core, so pairs
+ *                of children share a core
+ *   oversub[:K] - the first K CPUs of packed (default 1), so children outnumber CPUs
+ * Child i gets the (i mod n)-th CPU of the pattern's list of n CPUs.
+ * bench_slab accepts a comma-separated list and reports every pattern.
+ * Without sysfs (as in some containers), every CPU counts as its own core
+ * in one core complex.
+ */
+
+#ifndef GRADER_AFFINITY_H
+#define GRADER_AFFINITY_H
+
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define AFFINITY_SYSFS "/sys/devices/system/cpu"
+#define AFFINITY_MAX_NAME 32
+
+typedef struct {
+    int cpu;
+    int package, l3, core; // ids as sysfs numbers them
+    int l3_rank, core_rank, smt_rank; // within the package, the core complex and the core
+} affinity_cpu;
+
+typedef struct {
+    char name[AFFINITY_MAX_NAME];
+    int num_cpus; // 0 for none
+    int *cpus;
+} affinity_plan;
+
+// reads a single integer from a sysfs file, or returns `fallback`
+static int affinity_read_int(const char *path, int fallback) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return fallback;
+    int v;
+    if (fscanf(f, "%d", &v) != 1) v = fallback;
+    fclose(f);
+    return v;
+}
+
+// id of the L3 cache of `cpu`: its sysfs id, or else the first CPU sharing it, or -1 without one
+static int affinity_read_l3(int cpu) {
+    char path[128];
+    for (int idx=0; ; ++idx) {
+        snprintf(path, sizeof(path), AFFINITY_SYSFS "/cpu%d/cache/index%d/level", cpu, idx);
+        const int level = affinity_read_int(path, -1);
+        if (level == -1) return -1;
+        if (level != 3) continue;
+        snprintf(path, sizeof(path), AFFINITY_SYSFS "/cpu%d/cache/index%d/id", cpu, idx);
+        const int id = affinity_read_int(path, -1);
+        if (id != -1) return id;
+        snprintf(path, sizeof(path), AFFINITY_SYSFS "/cpu%d/cache/index%d/shared_cpu_list", cpu, idx);
+        return affinity_read_int(path, -1);
+    }
+}
+
+// how many CPUs of `cpus` come before cpus[i] in the group `same` puts it in, counting each `key` once
+static int affinity_rank(const affinity_cpu *cpus, int n, int i, bool (*same)(const affinity_cpu *, const affinity_cpu *), int (*key)(const affinity_cpu *)) {
+    int rank = 0;
+    for (int j=0; j!=n; ++j) {
+        if (!same(&cpus[j], &cpus[i]) || key(&cpus[j]) >= key(&cpus[i])) continue;
+        // only the first CPU with each key counts
+        bool first = true;
+        for (int k=0; k!=j && first; ++k) first = !(same(&cpus[k], &cpus[i]) && key(&cpus[k]) == key(&cpus[j]));
+        rank += first;
+    }
+    return rank;
+}
+
+static bool affinity_same_package(const affinity_cpu *a, const affinity_cpu *b) { return a->package == b->package; }
+static bool affinity_same_l3(const affinity_cpu *a, const affinity_cpu *b) { return a->package == b->package && a->l3 == b->l3; }
+static bool affinity_same_core(const affinity_cpu *a, const affinity_cpu *b) { return a->package == b->package && a->core == b->core; }
+static int affinity_l3_of(const affinity_cpu *c) { return c->l3; }
+static int affinity_core_of(const affinity_cpu *c) { return c->core; }
+static int affinity_cpu_of(const affinity_cpu *c) { return c->cpu; }
+
+// Fills in the ranks of a topology whose ids are already known.
+static void affinity_rank_all(affinity_cpu *cpus, int n) {
+    for (int i=0; i!=n; ++i) {
+        cpus[i].l3_rank = affinity_rank(cpus, n, i, affinity_same_package, affinity_l3_of);
+        cpus[i].core_rank = affinity_rank(cpus, n, i, affinity_same_l3, affinity_core_of);
+        cpus[i].smt_rank = affinity_rank(cpus, n, i, affinity_same_core, affinity_cpu_of);
+    }
+}
+
+// The CPUs this process may run on, in increasing order, with their topology; returns how many.
+static int affinity_read_topology(affinity_cpu **out) {
+    cpu_set_t mask;
+    if (sched_getaffinity(0, sizeof(mask), &mask) == -1) return 0;
+    affinity_cpu *cpus = malloc(sizeof(affinity_cpu) * CPU_COUNT(&mask));
+    int n = 0;
+    for (int cpu=0; cpu!=CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &mask)) continue;
+        char path[128];
+        snprintf(path, sizeof(path), AFFINITY_SYSFS "/cpu%d/topology/physical_package_id", cpu);
+        cpus[n].cpu = cpu;
+        cpus[n].package = affinity_read_int(path, 0);
+        snprintf(path, sizeof(path), AFFINITY_SYSFS "/cpu%d/topology/core_id", cpu);
+        cpus[n].core = affinity_read_int(path, cpu);
+        cpus[n].l3 = affinity_read_l3(cpu);
+        ++n;
+    }
+    affinity_rank_all(cpus, n);
+    *out = cpus;
+    return n;
+}
+
+// sort keys of the patterns, most significant first
+static void affinity_key(const affinity_cpu *c, bool spread, bool smt, int key[5]) {
+    if (spread) {
+        const int k[5] = {c->smt_rank, c->core_rank, c->l3_rank, c->package, c->cpu};
+        memcpy(key, k, sizeof(k));
+    }
+    else {
+        const int k[5] = {c->package, c->l3_rank, smt ? c->core_rank : c->smt_rank, smt ? c->smt_rank : c->core_rank, c->cpu};
+        memcpy(key, k, sizeof(k));
+    }
+}
+
+static bool affinity_key_less(const int a[5], const int b[5]) {
+    for (int f=0; f!=5; ++f) {
+        if (a[f] != b[f]) return a[f] < b[f];
+    }
+    return false;
+}
+
+// Orders the CPUs of a topology for `pattern`; returns false if the pattern is unknown.
+static bool affinity_make_plan(const affinity_cpu *cpus, int n, const char *pattern, affinity_plan *plan) {
+    snprintf(plan->name, sizeof(plan->name), "%s", pattern);
+    plan->num_cpus = 0;
+    plan->cpus = NULL;
+    if (strcmp(pattern, "none") == 0) return true;
+    int limit = n;
+    const bool spread = strcmp(pattern, "spread") == 0;
+    const bool smt = strcmp(pattern, "smt") == 0;
+    const bool packed = strcmp(pattern, "packed") == 0;
+    if (strncmp(pattern, "oversub", 7) == 0 && (pattern[7] == '\0' || pattern[7] == ':')) {
+        limit = pattern[7] == ':' ? atoi(pattern + 8) : 1;
+        if (limit < 1) return false;
+    }
+    else if (!spread && !smt && !packed) {
+        return false;
+    }
+    if (n == 0) return true;
+    // selection sort, as there are few CPUs and the order is computed once
+    int *order = malloc(sizeof(int) * n);
+    bool *taken = calloc(n, sizeof(bool));
+    int first = -1;
+    for (int k=0; k!=n; ++k) {
+        int best = -1, best_key[5];
+        for (int i=0; i!=n; ++i) {
+            int key[5];
+            affinity_key(&cpus[i], spread, smt, key);
+            if (!taken[i] && (best == -1 || affinity_key_less(key, best_key))) {
+                best = i;
+                memcpy(best_key, key, sizeof(key));
+            }
+        }
+        if (first == -1) first = best;
+        // packed stays within the core complex of its first CPU
+        if (packed && !affinity_same_l3(&cpus[best], &cpus[first])) break;
+        taken[best] = true;
+        order[plan->num_cpus++] = cpus[best].cpu;
+    }
+    free(taken);
+    plan->cpus = order;
+    if (plan->num_cpus > limit) plan->num_cpus = limit;
+    return true;
+}
+
+// Builds the plan for `pattern` on this machine; returns false if the pattern is unknown.
+static bool affinity_plan_for(const char *pattern, affinity_plan *plan) {
+    affinity_cpu *cpus = NULL;
+    const int n = affinity_read_topology(&cpus);
+    const bool ok = affinity_make_plan(cpus, n, pattern, plan);
+    free(cpus);
+    return ok;
+}
+
+// Call in child `idx` right after fork.
+static void affinity_pin(const affinity_plan *plan, int idx) {
+    if (plan->num_cpus == 0) return;
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(plan->cpus[idx % plan->num_cpus], &mask);
+    sched_setaffinity(0, sizeof(mask), &mask);
+}
+
+// writes the CPUs of the plan as "name: cpu,cpu,..." so that runs can be compared across machines
+static void affinity_describe(const affinity_plan *plan, FILE *f) {
+    fprintf(f, "placement %s:", plan->name);
+    if (plan->num_cpus == 0) fprintf(f, " not pinned");
+    for (int i=0; i!=plan->num_cpus; ++i) fprintf(f, "%s%d", i == 0 ? " " : ",", plan->cpus[i]);
+    fprintf(f, "\n");
+}
+
+static void affinity_free(affinity_plan *plan) {
+    free(plan->cpus);
+    plan->cpus = NULL;
+    plan->num_cpus = 0;
+}
+
+#endif
@@ -7,6 +7,11 @@
  * or check if the memory is unmapped,
  * so as not to double-penalise students
  * (who will already be penalised in ex2).
+ * Responses are collected with epoll in arrival order,
+ * so it scales to thousands of children.
+ * Set SHMHEAP_TRACE=path for a timeline of the shmheap calls, or SHMHEAP_PERF=path
+ * for their perf counters (see grader_trace.h), and SHMHEAP_PLACEMENT=pattern
+ * to pin the children to CPUs (see grader_affinity.h).
  */
 
 #include <assert.h>
@@ -16,7 +21,9 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -24,6 +31,8 @@
 #include <unistd.h>
 
 #include "shmheap.h"
+#include "grader_trace.h"
+#include "grader_affinity.h"
 
 #define SHMHEAP_CONNECT 0
 #define SHMHEAP_DISCONNECT 1
@@ -32,6 +41,7 @@
 #define SHMHEAP_FREE 4
 
 #define OBJECT_SIZE 32
+#define MAX_EVENTS 64
 
 typedef struct {
     int fd[2];
@@ -43,53 +53,64 @@ typedef struct {
 
 static const char *shm_prefix = "/shmheap";
 
+// names are /shmheap-<id>-<i>, as explained in grading-ex1/grader_ex1.c
 static const char *find_good_shm_name(int *i) {
-    char *ret = malloc(20 * sizeof(char));
-    memcpy(ret, shm_prefix, strlen(shm_prefix));
-    while (true) {
-        sprintf(ret + strlen(shm_prefix), "%d", (*i)++);
-        int fd;
-        if ((fd = shm_open(ret, O_RDWR, 0)) == -1) {
-            if (errno == ENOENT) return ret;
-            else if (errno == EINVAL || errno == EMFILE || errno == ENAMETOOLONG || errno == ENFILE) {
-                printf("Unexpected error\n");
-                exit(EXIT_FAILURE);
-            }
+    static char run_id[48];
+    if (run_id[0] == '\0') {
+        const char *env = getenv("SHMHEAP_RUN_ID");
+        if (env != NULL && env[0] != '\0') {
+            snprintf(run_id, sizeof(run_id), "%s", env);
         }
         else {
-            close(fd);
+            unsigned int nonce = time(NULL);
+            const int fd = open("/dev/urandom", O_RDONLY);
+            if (fd != -1) {
+                read(fd, &nonce, sizeof(nonce));
+                close(fd);
+            }
+            snprintf(run_id, sizeof(run_id), "%d-%08x", (int)getpid(), nonce);
         }
     }
+    char *ret = malloc(80 * sizeof(char));
+    snprintf(ret, 80, "%s-%s-%d", shm_prefix, run_id, (*i)++);
+    return ret;
 }
 
 static int randint(int min, int max) {
     return rand() % (max - min + 1) + min;
 }
 
-static int child_proc(const bidir_pipe *bp, const char *mem_name) {
+static int child_proc(const bidir_pipe *bp, const char *mem_name, int child_idx) {
     shmheap_memory_handle mem;
     void *base;
     int input_fd = bp->in.fd[0];
     int output_fd = bp->out.fd[1];
     int res;
     int type;
+    trace_call tc;
     while (read(input_fd, &type, sizeof(type)) == sizeof(type)) {
         switch (type) {
             case SHMHEAP_CONNECT: {
+                tc = trace_begin(child_idx, TRACE_CONNECT);
                 mem = shmheap_connect(mem_name);
+                trace_end(&tc);
                 base = shmheap_underlying(mem);
                 char dummy = 0;
                 write(output_fd, &dummy, sizeof(dummy));
                 break;
             }
             case SHMHEAP_DISCONNECT: {
+                tc = trace_begin(child_idx, TRACE_DISCONNECT);
                 shmheap_disconnect(mem);
+                trace_end(&tc);
                 char dummy = 0;
                 write(output_fd, &dummy, sizeof(dummy));
                 break;
             }
             case SHMHEAP_ALLOC: {
+                tc = trace_begin(child_idx, TRACE_ALLOC);
                 void *data = shmheap_alloc(mem, OBJECT_SIZE);
+                trace_end(&tc);
                 shmheap_object_handle hdl = shmheap_ptr_to_handle(mem, data);
                 write(output_fd, &hdl, sizeof(hdl));
                 break;
@@ -98,8 +119,12 @@ static int child_proc(const bidir_pipe *bp, const char *mem_name) {
                 shmheap_object_handle hdl;
                 res = read(input_fd, &hdl, sizeof(hdl));
                 assert(res == sizeof(hdl));
+                tc = trace_begin(child_idx, TRACE_HANDLE_TO_PTR);
                 void *data = shmheap_handle_to_ptr(mem, hdl);
+                trace_end(&tc);
+                tc = trace_begin(child_idx, TRACE_FREE);
                 shmheap_free(mem, data);
+                trace_end(&tc);
                 char dummy = 0;
                 write(output_fd, &dummy, sizeof(dummy));
                 break;
@@ -114,10 +139,52 @@ static int child_proc(const bidir_pipe *bp, const char *mem_name) {
 }
 
 static ssize_t checked_write(int fd, const void *buf, size_t count, int *errcode) {
-    if (write(fd, buf, count) == -1 && errno != EPIPE) {
+    ssize_t res;
+    while ((res = write(fd, buf, count)) == -1 && errno == EINTR) trace_check_stop();
+    if (res == -1 && errno != EPIPE) {
         printf("Write failed\n");
         if (*errcode == 0) *errcode = 98;
     }
+    return res;
+}
+
+// Every live child has exactly one response outstanding in each stage.
+// Collects them in whatever order they arrive, so one slow child does not hold up the rest.
+// Children whose pipe is closed are marked dead and not waited for again.
+static void collect_responses(int epfd, const bidir_pipe *pp, int num_proc, bool *alive, shmheap_object_handle *responses) {
+    int outstanding = 0;
+    for (int i=0; i!=num_proc; ++i) {
+        if (alive[i]) ++outstanding;
+    }
+    struct epoll_event events[MAX_EVENTS];
+    while (outstanding != 0) {
+        const int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            assert(errno == EINTR);
+            trace_check_stop();
+            continue;
+        }
+        for (int k=0; k!=n; ++k) {
+            const int i = events[k].data.u32;
+            // a packet from O_DIRECT pipes is read whole, whether it is a handle or a dummy byte
+            if (read(pp[i].out.fd[0], &responses[i], sizeof(responses[i])) <= 0) {
+                alive[i] = false;
+                epoll_ctl(epfd, EPOLL_CTL_DEL, pp[i].out.fd[0], NULL);
+            }
+            --outstanding;
+        }
+    }
+}
+
+// Each child needs two pipe ends in the parent, so large N needs more than the default 1024 fds.
+static bool raise_fd_limit(int num_proc) {
+    struct rlimit rl;
+    const rlim_t needed = 2 * (rlim_t)num_proc + 64;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1) return false;
+    if (rl.rlim_cur >= needed) return true;
+    if (rl.rlim_max != RLIM_INFINITY && rl.rlim_max < needed) return false;
+    rl.rlim_cur = needed;
+    return setrlimit(RLIMIT_NOFILE, &rl) == 0;
 }
 
 static int voidptr_cmp(const void *a, const void *b) {
@@ -154,13 +221,18 @@ int main (int argc, char *argv[]) {
     sscanf(argv[2], "%zu", &mid_space);
     const int num_proc = atoi(argv[3]);
 
-    if (argc > 2) {
+    if (argc > 4) {
         const int seed = atoi(argv[4]);
         srand(seed ? seed : time(NULL));
     }
 
     assert(num_proc > 0 && num_proc % 2 == 0);
 
+    if (!raise_fd_limit(num_proc)) {
+        printf("Cannot raise the open file limit for %d children\n", num_proc);
+        return 1; // run failed
+    }
+
     int i = 0;
 
     // find a name for our shm heap
@@ -169,6 +241,17 @@ int main (int argc, char *argv[]) {
     // create pipes
     bidir_pipe *const pp = malloc(sizeof(bidir_pipe) * num_proc);
 
+    trace_init(num_proc);
+
+    affinity_plan placement;
+    const char *pattern = getenv("SHMHEAP_PLACEMENT");
+    if (!affinity_plan_for(pattern != NULL && pattern[0] != '\0' ? pattern : "none", &placement)) {
+        printf("Unknown placement %s\n", pattern);
+        return 1; // run failed
+    }
+    if (placement.num_cpus != 0) affinity_describe(&placement, stdout);
+    fflush(stdout); // or the children would print it again when they exit
+
     const size_t mem_size = (OBJECT_SIZE + 16) * num_proc * 2 /* ordering possibility */ + 80 + 1024 /* spare space */;
 
     // spawn children
@@ -186,14 +269,29 @@ int main (int argc, char *argv[]) {
             close(pp[i].out.fd[0]);
             const bidir_pipe curr_pp = pp[i];
             free(pp);
-            return child_proc(&curr_pp, mem_name);
+            affinity_pin(&placement, i);
+            trace_child_started();
+            return child_proc(&curr_pp, mem_name, i);
         }
         close(pp[i].in.fd[0]);
         close(pp[i].out.fd[1]);
     }
 
+    // every child's response pipe is watched for the whole run
+    const int epfd = epoll_create1(0);
+    assert(epfd != -1);
+    bool *alive = malloc(sizeof(bool) * num_proc);
+    shmheap_object_handle *responses = calloc(num_proc, sizeof(shmheap_object_handle));
+    for (int i=0; i!=num_proc; ++i) {
+        struct epoll_event ev = {.events = EPOLLIN, .data.u32 = i};
+        epoll_ctl(epfd, EPOLL_CTL_ADD, pp[i].out.fd[0], &ev);
+        alive[i] = true;
+    }
+
     // init the shm heap
+    trace_call tc = trace_begin(num_proc, TRACE_CREATE);
     shmheap_memory_handle mem = shmheap_create(mem_name, mem_size);
+    trace_end(&tc);
 
     void *const base = shmheap_underlying(mem);
 
@@ -206,20 +304,16 @@ int main (int argc, char *argv[]) {
         int type = SHMHEAP_CONNECT;
         checked_write(pp[i].in.fd[1], &type, sizeof(type), &errcode);
     }
-    for (int i=0; i!=num_proc; ++i) {
-        char dummy;
-        read(pp[i].out.fd[0], &dummy, sizeof(dummy));
-    }
+    collect_responses(epfd, pp, num_proc, alive, responses);
 
     // send SHMHEAP_ALLOC command
     for (int i=0; i!=num_proc; ++i) {
         int type = SHMHEAP_ALLOC;
         checked_write(pp[i].in.fd[1], &type, sizeof(type), &errcode);
     }
+    collect_responses(epfd, pp, num_proc, alive, responses);
     for (int i=0; i!=num_proc; ++i) {
-        shmheap_object_handle hdl;
-        read(pp[i].out.fd[0], &hdl, sizeof(hdl));
-        objects[i] = shmheap_handle_to_ptr(mem, hdl);
+        objects[i] = shmheap_handle_to_ptr(mem, responses[i]);
     }
 
     // check that the set of objects returned is as expected
@@ -260,19 +354,12 @@ int main (int argc, char *argv[]) {
             }
         }
 
+        collect_responses(epfd, pp, num_proc, alive, responses);
         for (int i=0; i!=num_proc; ++i) {
-            if (selected_processes[i] < num_swap) {
-                int swapidx = selected_processes[i];
-                int swapval = selected_swap_indices[swapidx];
-                char dummy;
-                read(pp[i].out.fd[0], &dummy, sizeof(dummy));
-            }
-            else {
+            if (selected_processes[i] >= num_swap) {
                 int swapidx = selected_processes[i] - num_swap;
                 int swapval = selected_swap_indices[swapidx];
-                shmheap_object_handle hdl;
-                read(pp[i].out.fd[0], &hdl, sizeof(hdl));
-                objects[swapval] = shmheap_handle_to_ptr(mem, hdl);
+                objects[swapval] = shmheap_handle_to_ptr(mem, responses[i]);
             }
         }
 
@@ -296,30 +383,31 @@ int main (int argc, char *argv[]) {
         shmheap_object_handle hdl = shmheap_ptr_to_handle(mem, objects[i]);
         checked_write(pp[i].in.fd[1], &hdl, sizeof(hdl), &errcode);
     }
-    for (int i=0; i!=num_proc; ++i) {
-        char dummy;
-        read(pp[i].out.fd[0], &dummy, sizeof(dummy));
-    }
+    collect_responses(epfd, pp, num_proc, alive, responses);
 
+    tc = trace_begin(num_proc, TRACE_ALLOC);
     void *obj = shmheap_alloc(mem, (OBJECT_SIZE + 16) * num_proc);
+    trace_end(&tc);
     if (base + first_space != obj)  {
         printf("Final alloc was at unexpected location: got %p, expected %p\n", obj, base + first_space);
         readerr = 1;
     }
 
+    tc = trace_begin(num_proc, TRACE_FREE);
     shmheap_free(mem, obj);
+    trace_end(&tc);
 
     // send SHMHEAP_DISCONNECT command
     for (int i=0; i!=num_proc; ++i) {
         int type = SHMHEAP_DISCONNECT;
         checked_write(pp[i].in.fd[1], &type, sizeof(type), &errcode);
     }
-    for (int i=0; i!=num_proc; ++i) {
-        char dummy;
-        read(pp[i].out.fd[0], &dummy, sizeof(dummy));
-    }
+    collect_responses(epfd, pp, num_proc, alive, responses);
 
     free(objects);
+    free(responses);
+    free(alive);
+    close(epfd);
     
     for (int i=0; i!=num_proc; ++i) {
         close(pp[i].in.fd[1]);
@@ -328,12 +416,14 @@ int main (int argc, char *argv[]) {
 
     // free pipes
     free(pp);
+    affinity_free(&placement);
 
     // wait for children
     for (int i=0; i!=num_proc; ++i) {
         int status;
         int pid;
-        if ((pid = wait(&status)) == -1) {
+        while ((pid = wait(&status)) == -1 && errno == EINTR) trace_check_stop();
+        if (pid == -1) {
             printf("Child mysteriously disappeared\n");
             if (errcode == 0) errcode = 4;
         }
@@ -363,7 +453,11 @@ int main (int argc, char *argv[]) {
     }
 
     // destroy shm
+    tc = trace_begin(num_proc, TRACE_DESTROY);
     shmheap_destroy(mem_name, mem);
+    trace_end(&tc);
+
+    trace_write();
 
     if (errcode == 0 && readerr != 0) return readerr;
 
@@ -0,0 +1,313 @@
+/**
+ * Optional instrumentation of the shmheap calls made by the graders.
+ *
+ * SHMHEAP_TRACE=path records a timeline: every child records the begin and end
+ * of its calls into its own slot of a shared buffer (a single writer per slot,
+ * so no locks are needed), and the parent merges all slots into a Chrome
+ * trace-event JSON file at exit, which chrome://tracing or Perfetto can load.
+ * Calls that never returned are written as unfinished slices, and the parent
+ * also writes the file if it is stopped with SIGINT or SIGTERM while it waits
+ * for its children, so hangs show up.
+ *
+ * SHMHEAP_PERF=path counts cycles, instructions, LLC misses, branch misses and
+ * context switches around every call with perf_event_open, and writes their
+ * per-call averages for each op type and each child as CSV at exit. Without
+ * access to the hardware PMU (as in most containers), it falls back to the
+ * software counters: task clock, page faults, CPU migrations and context switches.
+ */
+
+#ifndef GRADER_TRACE_H
+#define GRADER_TRACE_H
+
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_EVENTS_PER_SLOT 4096
+#define PERF_MAX_COUNTERS 5
+
+enum trace_op { TRACE_CONNECT, TRACE_DISCONNECT, TRACE_ALLOC, TRACE_FREE, TRACE_HANDLE_TO_PTR, TRACE_CREATE, TRACE_DESTROY, TRACE_NUM_OPS };
+
+static const char *const trace_op_names[] = {"shmheap_connect", "shmheap_disconnect", "shmheap_alloc", "shmheap_free", "shmheap_handle_to_ptr", "shmheap_create", "shmheap_destroy"};
+
+typedef struct {
+    uint64_t begin, end; // ns since trace_init, end is 0 while the call is running
+    uint32_t op;
+} trace_event;
+
+typedef struct {
+    uint32_t count;
+    uint32_t dropped;
+    trace_event events[TRACE_EVENTS_PER_SLOT];
+} trace_slot;
+
+typedef struct {
+    uint64_t calls[TRACE_NUM_OPS];
+    uint64_t sums[TRACE_NUM_OPS][PERF_MAX_COUNTERS];
+} perf_slot;
+
+typedef struct {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} perf_counter;
+
+static const perf_counter perf_hw_counters[] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "llc_misses"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch_misses"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "ctx_switches"},
+};
+static const perf_counter perf_sw_counters[] = {
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task_clock_ns"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page_faults"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, "cpu_migrations"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "ctx_switches"},
+};
+
+// Passed from trace_begin to trace_end of the same call.
+typedef struct {
+    trace_event *ev;
+    int slot;
+    enum trace_op op;
+    uint64_t counters[PERF_MAX_COUNTERS];
+} trace_call;
+
+static int trace_num_slots;
+static trace_slot *trace_slots; // NULL when tracing is off
+static const char *trace_path;
+static uint64_t trace_origin;
+static perf_slot *perf_slots; // NULL when profiling is off
+static const char *perf_path;
+static const perf_counter *perf_counters;
+static int perf_num_counters;
+static int perf_exclude_kernel;
+static int perf_fd = -1; // group leader of this process's counters
+static uint64_t perf_overhead[PERF_MAX_COUNTERS]; // counted by an empty measurement, included in every call
+
+static uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec - trace_origin;
+}
+
+// Opens the counters of the calling process as one group, so they are read with a single read().
+static int perf_open(const perf_counter *counters, int n, int exclude_kernel) {
+    int leader = -1;
+    for (int i=0; i!=n; ++i) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counters[i].type;
+        attr.config = counters[i].config;
+        attr.exclude_kernel = exclude_kernel;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.disabled = leader == -1;
+        const int fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+        if (fd == -1) {
+            if (leader != -1) close(leader); // closing the leader releases the whole group
+            return -1;
+        }
+        if (leader == -1) leader = fd;
+    }
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return leader;
+}
+
+static void perf_read(uint64_t *out) {
+    uint64_t buf[1 + PERF_MAX_COUNTERS];
+    if (read(perf_fd, buf, sizeof(uint64_t) * (1 + perf_num_counters)) == -1) {
+        memset(out, 0, sizeof(uint64_t) * perf_num_counters);
+        return;
+    }
+    memcpy(out, buf + 1, sizeof(uint64_t) * perf_num_counters);
+}
+
+// Picks the richest counter set this machine allows, trying it in the calling process.
+static void perf_init(void) {
+    const struct { const perf_counter *counters; int n; int exclude_kernel; } choices[] = {
+        {perf_hw_counters, sizeof(perf_hw_counters) / sizeof(perf_counter), 0},
+        {perf_hw_counters, sizeof(perf_hw_counters) / sizeof(perf_counter), 1},
+        {perf_sw_counters, sizeof(perf_sw_counters) / sizeof(perf_counter), 0},
+        {perf_sw_counters, sizeof(perf_sw_counters) / sizeof(perf_counter), 1},
+    };
+    for (size_t i=0; i!=sizeof(choices) / sizeof(choices[0]); ++i) {
+        if ((perf_fd = perf_open(choices[i].counters, choices[i].n, choices[i].exclude_kernel)) != -1) {
+            perf_counters = choices[i].counters;
+            perf_num_counters = choices[i].n;
+            perf_exclude_kernel = choices[i].exclude_kernel;
+            // the smallest of a few empty measurements is what the reads themselves cost
+            for (int k=0; k!=100; ++k) {
+                uint64_t before[PERF_MAX_COUNTERS], after[PERF_MAX_COUNTERS];
+                perf_read(before);
+                perf_read(after);
+                for (int c=0; c!=perf_num_counters; ++c) {
+                    if (k == 0 || after[c] - before[c] < perf_overhead[c]) perf_overhead[c] = after[c] - before[c];
+                }
+            }
+            return;
+        }
+    }
+}
+
+static void perf_write(void) {
+    if (perf_slots == NULL) return;
+    FILE *f = fopen(perf_path, "w");
+    if (f == NULL) return;
+    fprintf(f, "# %s counters%s, averaged per call\n", perf_counters == perf_hw_counters ? "hardware" : "software (no hardware PMU access)", perf_exclude_kernel ? ", user space only" : "");
+    fprintf(f, "scope,op,calls");
+    for (int c=0; c!=perf_num_counters; ++c) fprintf(f, ",%s", perf_counters[c].name);
+    fprintf(f, "\n");
+    fprintf(f, "overhead,(none),1");
+    for (int c=0; c!=perf_num_counters; ++c) fprintf(f, ",%.1f", (double)perf_overhead[c]);
+    fprintf(f, "\n");
+    // one row per op over all slots, then one row per op and slot
+    for (int s=-1; s!=trace_num_slots; ++s) {
+        for (int op=0; op!=TRACE_NUM_OPS; ++op) {
+            uint64_t calls = 0, sums[PERF_MAX_COUNTERS] = {0};
+            for (int t = s == -1 ? 0 : s; t != (s == -1 ? trace_num_slots : s + 1); ++t) {
+                calls += perf_slots[t].calls[op];
+                for (int c=0; c!=perf_num_counters; ++c) sums[c] += perf_slots[t].sums[op][c];
+            }
+            if (calls == 0) continue;
+            if (s == -1) fprintf(f, "all,%s,%lu", trace_op_names[op], (unsigned long)calls);
+            else if (s == trace_num_slots - 1) fprintf(f, "grader,%s,%lu", trace_op_names[op], (unsigned long)calls);
+            else fprintf(f, "child %d,%s,%lu", s, trace_op_names[op], (unsigned long)calls);
+            for (int c=0; c!=perf_num_counters; ++c) fprintf(f, ",%.1f", (double)sums[c] / calls);
+            fprintf(f, "\n");
+        }
+    }
+    fclose(f);
+}
+
+static void trace_write(void) {
+    perf_write();
+    if (trace_slots == NULL) return;
+    FILE *f = fopen(trace_path, "w");
+    if (f == NULL) return;
+    const int pid = getpid();
+    fprintf(f, "{\"traceEvents\":[\n");
+    for (int s=0; s!=trace_num_slots; ++s) {
+        const char *sep = s == 0 ? "" : ",\n";
+        if (s == trace_num_slots - 1) fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"grader\"}}", sep, pid, s);
+        else fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"child %d\"}}", sep, pid, s, s);
+        const trace_slot *slot = &trace_slots[s];
+        const uint32_t count = __atomic_load_n(&slot->count, __ATOMIC_ACQUIRE);
+        for (uint32_t k=0; k!=count; ++k) {
+            const trace_event *ev = &slot->events[k];
+            const uint64_t end = __atomic_load_n(&ev->end, __ATOMIC_RELAXED);
+            if (end == 0) {
+                fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"B\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f}", trace_op_names[ev->op], pid, s, ev->begin / 1e3);
+            }
+            else {
+                fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", trace_op_names[ev->op], pid, s, ev->begin / 1e3, (end - ev->begin) / 1e3);
+            }
+        }
+        if (slot->dropped != 0) {
+            fprintf(f, ",\n{\"name\":\"%u events dropped\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":0}", slot->dropped, pid, s);
+        }
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    fclose(f);
+}
+
+static volatile sig_atomic_t trace_stop_signal; // set by trace_signal_handler
+
+// fopen and fprintf are not async-signal-safe, so the handler only records the signal.
+// It is installed without SA_RESTART, so a parent blocked waiting for its children
+// gets EINTR and calls trace_check_stop, which writes the files from the normal flow.
+static void trace_signal_handler(int sig) {
+    trace_stop_signal = sig;
+}
+
+// Call wherever the parent waits; writes the files and exits if it was asked to stop.
+static void trace_check_stop(void) {
+    if (trace_stop_signal == 0) return;
+    trace_write();
+    _exit(128 + trace_stop_signal);
+}
+
+static void *trace_map(size_t bytes) {
+    void *mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return mem == MAP_FAILED ? NULL : mem;
+}
+
+// Call in the parent before forking; slots 0..num_children-1 are the children, slot num_children is the parent.
+static void trace_init(int num_children) {
+    trace_num_slots = num_children + 1;
+    trace_path = getenv("SHMHEAP_TRACE");
+    if (trace_path != NULL && trace_path[0] != '\0' && (trace_slots = trace_map(sizeof(trace_slot) * trace_num_slots)) == NULL) {
+        fprintf(stderr, "Cannot allocate the trace buffer, tracing is off\n");
+    }
+    perf_path = getenv("SHMHEAP_PERF");
+    if (perf_path != NULL && perf_path[0] != '\0') {
+        perf_init();
+        if (perf_fd == -1) fprintf(stderr, "perf_event_open is not available, profiling is off\n");
+        else if ((perf_slots = trace_map(sizeof(perf_slot) * trace_num_slots)) == NULL) fprintf(stderr, "Cannot allocate the profile buffer, profiling is off\n");
+    }
+    if (trace_slots == NULL && perf_slots == NULL) return;
+    trace_origin = 0;
+    trace_origin = trace_now();
+    struct sigaction sa = {0};
+    sa.sa_handler = trace_signal_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+}
+
+// Children must not write the files themselves, and need counters of their own.
+static void trace_child_started(void) {
+    if (trace_slots == NULL && perf_slots == NULL) return;
+    struct sigaction sa = {0};
+    sa.sa_handler = SIG_DFL;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    if (perf_slots != NULL) {
+        close(perf_fd);
+        perf_fd = perf_open(perf_counters, perf_num_counters, perf_exclude_kernel);
+    }
+}
+
+static trace_call trace_begin(int slot_idx, enum trace_op op) {
+    trace_call call = {NULL, slot_idx, op};
+    if (trace_slots != NULL) {
+        trace_slot *slot = &trace_slots[slot_idx];
+        if (slot->count == TRACE_EVENTS_PER_SLOT) {
+            ++slot->dropped;
+        }
+        else {
+            call.ev = &slot->events[slot->count];
+            call.ev->begin = trace_now();
+            call.ev->end = 0;
+            call.ev->op = op;
+            __atomic_store_n(&slot->count, slot->count + 1, __ATOMIC_RELEASE);
+        }
+    }
+    if (perf_slots != NULL && perf_fd != -1) perf_read(call.counters);
+    return call;
+}
+
+static void trace_end(trace_call *call) {
+    if (perf_slots != NULL && perf_fd != -1) {
+        uint64_t now[PERF_MAX_COUNTERS];
+        perf_read(now);
+        perf_slot *slot = &perf_slots[call->slot];
+        for (int c=0; c!=perf_num_counters; ++c) slot->sums[call->op][c] += now[c] - call->counters[c];
+        ++slot->calls[call->op];
+    }
+    if (call->ev != NULL) {
+        const uint64_t end = trace_now();
+        __atomic_store_n(&call->ev->end, end ? end : 1, __ATOMIC_RELEASE);
+    }
+}
+
+#endif
@@ -0,0 +1,75 @@
+/**
+ * Prints the name of every file that is written to or moved into a
+ * directory, one per line, for the grading service of script.sh:
+ *   watchdir directory
+ * The files already in the directory are printed first, after the watch is in
+ * place, so nothing that arrives while it starts up is missed (a file may be
+ * printed twice instead). A file is only printed once its writer closes it,
+ * or when it is renamed into the directory, so copies in progress are not.
+ * If the kernel drops events because they arrived too fast, the whole
+ * directory is printed again, as at startup.
+ *
+ * Exits with 0 when the directory is deleted or stdout is closed, and with 1
+ * if the directory cannot be watched.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define EVENT_BUF (64 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+
+static void print_name(const char *name) {
+    if (printf("%s\n", name) < 0 || fflush(stdout) == EOF) exit(0);
+}
+
+// prints every file already in the directory; returns false if it cannot be listed
+static bool print_files(const char *path) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) return false;
+    for (struct dirent *ent; (ent = readdir(dir)) != NULL;) {
+        if (ent->d_type == DT_REG || ent->d_type == DT_UNKNOWN) print_name(ent->d_name);
+    }
+    closedir(dir);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        printf("usage: %s directory\n", argv[0]);
+        return 1;
+    }
+    const int fd = inotify_init1(IN_CLOEXEC);
+    if (fd == -1 || inotify_add_watch(fd, argv[1], IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF) == -1) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    if (!print_files(argv[1])) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    char buf[EVENT_BUF] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (1) {
+        const ssize_t n = read(fd, buf, sizeof(buf));
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("read");
+            return 1;
+        }
+        for (char *p = buf; p < buf + n;) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) return 0;
+            // events were lost, so any file may have arrived unseen
+            if ((ev->mask & IN_Q_OVERFLOW) && !print_files(argv[1])) return 0;
+            if (ev->len != 0 && !(ev->mask & IN_ISDIR)) print_name(ev->name);
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+}
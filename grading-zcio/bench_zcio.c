@@ -0,0 +1,311 @@
+/**
+ * This benchmark measures the throughput of a zc_io.c submission
+ * for sequential and random reads and writes, on file sizes from 4 KiB
+ * up to `max_size`, against plain read/write syscalls and memcpy.
+ * Every data point reports MB/s and the page faults it took.
+ * Files are created in `dir` (default /dev/shm, a tmpfs on any Linux box),
+ * and sizes that do not fit in the free space there are skipped.
+ *
+ * Output is one CSV line per data point: op,size,impl,MB/s,minflt,majflt
+ * Returns 1 if data read back through zc_io is wrong, or if a file written
+ * through zc_io does not hold the expected content when read back with read().
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "zc_io.h"
+
+#define MIN_SIZE (4 << 10)
+#define SEQ_CHUNK (1 << 20)
+#define RAND_OP 4096
+#define MAX_RAND_OPS 16384
+
+typedef struct {
+    struct timespec start;
+    long minflt, majflt;
+} measurement;
+
+static char *chunk;       // pattern that every file is made of, repeated
+static char *sink;        // destination of the copying reads
+static uint64_t chunk_sum; // sum of the 64-bit words of one chunk
+static volatile uint64_t consumed; // keeps the baselines from optimising away their reads
+static char path[PATH_MAX];
+
+static void start_measure(measurement *m) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    m->minflt = ru.ru_minflt;
+    m->majflt = ru.ru_majflt;
+    clock_gettime(CLOCK_MONOTONIC, &m->start);
+}
+
+static void end_measure(const measurement *m, const char *op, size_t size, const char *impl, size_t bytes) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    const double secs = (end.tv_sec - m->start.tv_sec) + (end.tv_nsec - m->start.tv_nsec) / 1e9;
+    printf("%s,%zu,%s,%.1f,%ld,%ld\n", op, size, impl, bytes / 1e6 / secs, ru.ru_minflt - m->minflt, ru.ru_majflt - m->majflt);
+    fflush(stdout);
+}
+
+static uint64_t consume(const char *data, size_t len) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        sum += word;
+    }
+    return sum;
+}
+
+static size_t seq_len(size_t size, size_t done) {
+    return size - done < SEQ_CHUNK ? size - done : SEQ_CHUNK;
+}
+
+// offsets are in whole RAND_OPs, so every random op reads one chunk-aligned piece
+static size_t rand_offset(size_t size) {
+    const size_t slots = size / RAND_OP;
+    return ((size_t)rand() * RAND_MAX + rand()) % slots * RAND_OP;
+}
+
+static size_t rand_ops(size_t size) {
+    return size / RAND_OP < MAX_RAND_OPS ? size / RAND_OP : MAX_RAND_OPS;
+}
+
+static uint64_t expected_sum(size_t offset, size_t len) {
+    return consume(chunk + offset % SEQ_CHUNK, len);
+}
+
+// reads the file back with plain read() and checks that it is `size` bytes of the repeated chunk
+static bool file_matches(size_t size) {
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1) return false;
+    size_t done = 0;
+    ssize_t res;
+    // each read stops at the end of a chunk, so it compares against one piece of the pattern
+    while ((res = read(fd, sink, SEQ_CHUNK - done % SEQ_CHUNK)) > 0) {
+        if (done + res > size || memcmp(sink, chunk + done % SEQ_CHUNK, res) != 0) break;
+        done += res;
+    }
+    close(fd);
+    return res == 0 && done == size;
+}
+
+static int bench_size(size_t size) {
+    int errcode = 0;
+    measurement m;
+
+    // sequential writes
+    unlink(path);
+    start_measure(&m);
+    zc_file *zf = zc_open(path);
+    for (size_t done = 0; done != size; done += seq_len(size, done)) {
+        char *dst = zc_write_start(zf, seq_len(size, done));
+        memcpy(dst, chunk, seq_len(size, done));
+        zc_write_end(zf);
+    }
+    zc_close(zf);
+    end_measure(&m, "seq_write", size, "zc_io", size);
+    if (!file_matches(size)) {
+        printf("Sequential zc_write wrote incorrect data (size %zu)\n", size);
+        if (errcode == 0) errcode = 1;
+    }
+
+    unlink(path);
+    start_measure(&m);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    for (size_t done = 0; done != size; done += seq_len(size, done)) {
+        write(fd, chunk, seq_len(size, done));
+    }
+    close(fd);
+    end_measure(&m, "seq_write", size, "syscall", size);
+
+    char *buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
+        printf("Cannot allocate %zu bytes for the memcpy baseline\n", size);
+        unlink(path);
+        return errcode;
+    }
+    start_measure(&m);
+    for (size_t done = 0; done != size; done += seq_len(size, done)) {
+        memcpy(buf + done, chunk, seq_len(size, done));
+    }
+    end_measure(&m, "seq_write", size, "memcpy", size);
+
+    // sequential reads (the file written by the syscall baseline is the reference content)
+    uint64_t sum = 0;
+    start_measure(&m);
+    zf = zc_open(path);
+    for (size_t done = 0; done != size;) {
+        size_t len = seq_len(size, done);
+        const char *src = zc_read_start(zf, &len);
+        if (src == NULL || len == 0) break;
+        sum += consume(src, len);
+        zc_read_end(zf);
+        done += len;
+    }
+    zc_close(zf);
+    end_measure(&m, "seq_read", size, "zc_io", size);
+    const uint64_t seq_expected = chunk_sum * (size / SEQ_CHUNK) + consume(chunk, size % SEQ_CHUNK);
+    if (sum != seq_expected) {
+        printf("Sequential zc_read returned incorrect data (size %zu)\n", size);
+        if (errcode == 0) errcode = 1;
+    }
+
+    start_measure(&m);
+    fd = open(path, O_RDONLY);
+    for (size_t done = 0; done != size; done += seq_len(size, done)) {
+        read(fd, sink, seq_len(size, done));
+        consumed += consume(sink, seq_len(size, done));
+    }
+    close(fd);
+    end_measure(&m, "seq_read", size, "syscall", size);
+
+    start_measure(&m);
+    for (size_t done = 0; done != size; done += seq_len(size, done)) {
+        memcpy(sink, buf + done, seq_len(size, done));
+        consumed += consume(sink, seq_len(size, done));
+    }
+    end_measure(&m, "seq_read", size, "memcpy", size);
+
+    // random reads and writes of RAND_OP bytes at page-aligned offsets
+    const size_t ops = rand_ops(size);
+    const unsigned seed = size;
+
+    srand(seed);
+    start_measure(&m);
+    zf = zc_open(path);
+    for (size_t i = 0; i != ops; ++i) {
+        const size_t offset = rand_offset(size);
+        size_t len = RAND_OP;
+        zc_lseek(zf, offset, SEEK_SET);
+        const char *src = zc_read_start(zf, &len);
+        if (src == NULL || len != RAND_OP || consume(src, len) != expected_sum(offset, len)) {
+            if (errcode == 0) printf("Random zc_read returned incorrect data (size %zu, offset %zu)\n", size, offset);
+            if (errcode == 0) errcode = 1;
+        }
+        if (src != NULL) zc_read_end(zf);
+    }
+    zc_close(zf);
+    end_measure(&m, "rand_read", size, "zc_io", ops * RAND_OP);
+
+    srand(seed);
+    start_measure(&m);
+    fd = open(path, O_RDONLY);
+    for (size_t i = 0; i != ops; ++i) {
+        pread(fd, sink, RAND_OP, rand_offset(size));
+        consumed += consume(sink, RAND_OP);
+    }
+    close(fd);
+    end_measure(&m, "rand_read", size, "syscall", ops * RAND_OP);
+
+    srand(seed);
+    start_measure(&m);
+    for (size_t i = 0; i != ops; ++i) {
+        memcpy(sink, buf + rand_offset(size), RAND_OP);
+        consumed += consume(sink, RAND_OP);
+    }
+    end_measure(&m, "rand_read", size, "memcpy", ops * RAND_OP);
+
+    // random writes put back the content that is already there, so the file stays checkable
+    srand(seed);
+    start_measure(&m);
+    zf = zc_open(path);
+    for (size_t i = 0; i != ops; ++i) {
+        const size_t offset = rand_offset(size);
+        zc_lseek(zf, offset, SEEK_SET);
+        char *dst = zc_write_start(zf, RAND_OP);
+        memcpy(dst, chunk + offset % SEQ_CHUNK, RAND_OP);
+        zc_write_end(zf);
+    }
+    zc_close(zf);
+    end_measure(&m, "rand_write", size, "zc_io", ops * RAND_OP);
+    if (!file_matches(size)) {
+        printf("Random zc_write wrote incorrect data (size %zu)\n", size);
+        if (errcode == 0) errcode = 1;
+    }
+
+    srand(seed);
+    start_measure(&m);
+    fd = open(path, O_WRONLY);
+    for (size_t i = 0; i != ops; ++i) {
+        const size_t offset = rand_offset(size);
+        pwrite(fd, chunk + offset % SEQ_CHUNK, RAND_OP, offset);
+    }
+    close(fd);
+    end_measure(&m, "rand_write", size, "syscall", ops * RAND_OP);
+
+    srand(seed);
+    start_measure(&m);
+    for (size_t i = 0; i != ops; ++i) {
+        const size_t offset = rand_offset(size);
+        memcpy(buf + offset, chunk + offset % SEQ_CHUNK, RAND_OP);
+    }
+    end_measure(&m, "rand_write", size, "memcpy", ops * RAND_OP);
+
+    munmap(buf, size);
+    unlink(path);
+    return errcode;
+}
+
+static size_t parse_size(const char *str) {
+    char *end;
+    size_t size = strtoull(str, &end, 10);
+    switch (*end) {
+        case 'G': case 'g': size <<= 10; /* fallthrough */
+        case 'M': case 'm': size <<= 10; /* fallthrough */
+        case 'K': case 'k': size <<= 10;
+    }
+    return size;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "-h") == 0) {
+        printf("usage: %s [max_size=1G] [dir=/dev/shm]\n", argv[0]);
+        return 1; // run failed
+    }
+    const size_t max_size = argc > 1 ? parse_size(argv[1]) : (size_t)1 << 30;
+    const char *dir = argc > 2 ? argv[2] : "/dev/shm";
+    snprintf(path, sizeof(path), "%s/zcio-bench.%d", dir, (int)getpid());
+
+    chunk = malloc(SEQ_CHUNK);
+    sink = malloc(SEQ_CHUNK);
+    for (size_t i = 0; i != SEQ_CHUNK / sizeof(uint64_t); ++i) {
+        const uint64_t word = (i + 1) * 0x9E3779B97F4A7C15ull;
+        memcpy(chunk + i * sizeof(word), &word, sizeof(word));
+    }
+    chunk_sum = consume(chunk, SEQ_CHUNK);
+
+    int errcode = 0;
+    printf("op,size,impl,MB/s,minflt,majflt\n");
+    for (size_t size = MIN_SIZE; size <= max_size; size *= 4) {
+        struct statvfs vfs;
+        if (statvfs(dir, &vfs) == 0 && (size_t)vfs.f_bavail * vfs.f_frsize < size + (size >> 3)) {
+            printf("Skipping size %zu: not enough space in %s\n", size, dir);
+            break;
+        }
+        const int res = bench_size(size);
+        if (errcode == 0) errcode = res;
+    }
+
+    free(sink);
+    free(chunk);
+    return errcode;
+}
@@ -0,0 +1,435 @@
+/**
+ * This runner stress-tests a zc_io.c submission under concurrency.
+ * For every level of concurrency (1, 2, 4, ... up to `max_processes`
+ * processes, each running 1, 2, 4, ... up to `max_threads` threads that
+ * share one zc_file), all workers overlap zc_read/zc_write calls on the same
+ * file, and some writes append new regions so the mapping has to grow
+ * while other threads are reading.
+ *
+ * The file is made of REGION-byte records: [version][payload][version],
+ * where the payload is derived from (region, version), so every record can be
+ * checked on its own. Regions are only written by the process that owns them
+ * (zc_io gives no guarantees across zc_files), while readers in the owning
+ * process must never see a torn or stale record. After each level, the whole
+ * file is checked against the last version committed for every region.
+ *
+ * Reports ops/s, MB/s and p50/p99/p99.9 latency per level.
+ * Exit codes follow the shmheap graders: 1 for incorrect data, 128 + signal
+ * if a worker crashed, 97 for a weird worker exit code, and 6 if zc_open
+ * failed in a worker.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "zc_io.h"
+
+#define REGION 4096
+#define PAYLOAD_WORDS (REGION / sizeof(uint64_t) - 2)
+#define INITIAL_REGIONS 64
+#define LATENCY_BUCKETS 256
+#define NO_REGION UINT64_MAX
+
+#define OP_READ 0
+#define OP_WRITE 1
+#define OP_APPEND 2
+
+#define ZC_OPEN_FAILED 6
+
+#define START_WAIT 0
+#define START_GO 1
+#define START_ABORT 2 // a worker process exited before every worker was ready
+
+typedef struct {
+    uint64_t ops[3];
+    uint64_t skipped; // reads of another process's regions that raced with its writer
+    uint64_t latency[LATENCY_BUCKETS];
+} worker_stats;
+
+// lives in MAP_SHARED memory, so every process of a level sees the same copy
+typedef struct {
+    uint32_t ready; // workers waiting for the start
+    uint32_t start; // futex word: START_WAIT, then START_GO or START_ABORT
+    pthread_mutex_t append_lock; // appends grow the file in region order, so no process truncates another's append
+    uint64_t total_regions;
+    uint64_t first_start, last_end; // ns, over all workers
+    int errcode;
+    uint64_t *committed; // last version fully written to each region, 0 if never
+    uint64_t *versions;  // last version handed out for each region
+    int *owner;          // process that may write each region
+    worker_stats *stats;
+} shared_state;
+
+typedef struct {
+    shared_state *sh;
+    zc_file *file;
+    pthread_mutex_t *seek_lock; // makes zc_lseek + zc_*_start one step for threads sharing the zc_file
+    int proc_idx, worker_idx;
+    size_t ops;
+    uint64_t rng;
+} worker_args;
+
+static char path[PATH_MAX];
+
+static uint64_t next_rand(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static uint64_t payload_word(uint64_t region, uint64_t version, size_t i) {
+    uint64_t x = (region << 32 ^ version) * 0x9E3779B97F4A7C15ull + i;
+    x ^= x >> 31;
+    return x * 0xBF58476D1CE4E5B9ull;
+}
+
+static void write_record(char *dst, uint64_t region, uint64_t version) {
+    uint64_t *words = (uint64_t *)dst;
+    __atomic_store_n(&words[0], version, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (size_t i = 0; i != PAYLOAD_WORDS; ++i) words[1 + i] = payload_word(region, version, i);
+    __atomic_store_n(&words[1 + PAYLOAD_WORDS], version, __ATOMIC_RELEASE);
+}
+
+// Returns the version of a consistent record, 0 if it was torn by a concurrent writer,
+// or UINT64_MAX if it is consistent but its payload is wrong.
+static uint64_t check_record(const char *src, uint64_t region) {
+    const uint64_t *words = (const uint64_t *)src;
+    const uint64_t end = __atomic_load_n(&words[1 + PAYLOAD_WORDS], __ATOMIC_ACQUIRE);
+    bool payload_ok = true;
+    for (size_t i = 0; i != PAYLOAD_WORDS; ++i) {
+        if (words[1 + i] != payload_word(region, end, i)) payload_ok = false;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    const uint64_t begin = __atomic_load_n(&words[0], __ATOMIC_RELAXED);
+    if (begin != end) return 0;
+    return payload_ok ? end : UINT64_MAX;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// 4 sub-buckets per power of two
+static int latency_bucket(uint64_t ns) {
+    if (ns < 16) return ns;
+    const int msb = 63 - __builtin_clzll(ns);
+    const int idx = 16 + (msb - 4) * 4 + ((ns >> (msb - 2)) & 3);
+    return idx < LATENCY_BUCKETS ? idx : LATENCY_BUCKETS - 1;
+}
+
+static uint64_t bucket_value(int idx) {
+    if (idx < 16) return idx;
+    const int msb = (idx - 16) / 4 + 4;
+    return (1ull << msb) + ((uint64_t)((idx - 16) % 4) << (msb - 2));
+}
+
+static void set_error(shared_state *sh, int code) {
+    int expected = 0;
+    __atomic_compare_exchange_n(&sh->errcode, &expected, code, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+static void commit(shared_state *sh, uint64_t region, uint64_t version) {
+    uint64_t cur = __atomic_load_n(&sh->committed[region], __ATOMIC_RELAXED);
+    while (cur < version && !__atomic_compare_exchange_n(&sh->committed[region], &cur, version, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// writes `region`, or a new region at the end of the file if it is NO_REGION
+static void do_write(worker_args *wa, uint64_t region) {
+    shared_state *sh = wa->sh;
+    const bool append = region == NO_REGION;
+    if (append) {
+        pthread_mutex_lock(&sh->append_lock);
+        region = sh->total_regions;
+        sh->owner[region] = wa->proc_idx;
+        __atomic_store_n(&sh->total_regions, region + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_lock(wa->seek_lock);
+    zc_lseek(wa->file, region * REGION, SEEK_SET);
+    char *dst = zc_write_start(wa->file, REGION);
+    pthread_mutex_unlock(wa->seek_lock);
+    if (append) pthread_mutex_unlock(&sh->append_lock);
+    // versions are handed out inside the write window, so they follow the order the writes happen in
+    const uint64_t version = __atomic_add_fetch(&sh->versions[region], 1, __ATOMIC_RELAXED);
+    write_record(dst, region, version);
+    zc_write_end(wa->file);
+    commit(sh, region, version);
+}
+
+static void do_read(worker_args *wa, uint64_t region) {
+    shared_state *sh = wa->sh;
+    const uint64_t before = __atomic_load_n(&sh->committed[region], __ATOMIC_ACQUIRE);
+    size_t len = REGION;
+    pthread_mutex_lock(wa->seek_lock);
+    zc_lseek(wa->file, region * REGION, SEEK_SET);
+    const char *src = zc_read_start(wa->file, &len);
+    pthread_mutex_unlock(wa->seek_lock);
+    if (src == NULL || len != REGION) {
+        printf("Worker %d: short read of region %lu (%zu bytes)\n", wa->worker_idx, (unsigned long)region, src ? len : 0);
+        set_error(sh, 1);
+        if (src != NULL) zc_read_end(wa->file);
+        return;
+    }
+    const uint64_t version = check_record(src, region);
+    zc_read_end(wa->file);
+    if (version == 0 && sh->owner[region] != wa->proc_idx) {
+        ++sh->stats[wa->worker_idx].skipped;
+    }
+    else if (version == 0 || version == UINT64_MAX) {
+        printf("Worker %d: region %lu is corrupted\n", wa->worker_idx, (unsigned long)region);
+        set_error(sh, 1);
+    }
+    else if (version < before) {
+        printf("Worker %d: region %lu is stale (version %lu, expected at least %lu)\n", wa->worker_idx, (unsigned long)region, (unsigned long)version, (unsigned long)before);
+        set_error(sh, 1);
+    }
+}
+
+// announces the worker as ready and waits for the parent to start the level; returns false if it was aborted
+static bool wait_for_start(shared_state *sh) {
+    __atomic_add_fetch(&sh->ready, 1, __ATOMIC_RELEASE);
+    uint32_t start;
+    while ((start = __atomic_load_n(&sh->start, __ATOMIC_ACQUIRE)) == START_WAIT) {
+        syscall(SYS_futex, &sh->start, FUTEX_WAIT, START_WAIT, NULL, NULL, 0);
+    }
+    return start == START_GO;
+}
+
+static void *worker_thread(void *arg) {
+    worker_args *wa = arg;
+    shared_state *sh = wa->sh;
+    worker_stats *st = &sh->stats[wa->worker_idx];
+    if (!wait_for_start(sh)) return NULL;
+    const uint64_t begin = now_ns();
+    for (size_t i = 0; i != wa->ops && __atomic_load_n(&sh->errcode, __ATOMIC_RELAXED) == 0; ++i) {
+        const uint64_t r = next_rand(&wa->rng);
+        const int op = r % 10 < 7 ? OP_READ : r % 10 < 9 ? OP_WRITE : OP_APPEND;
+        const uint64_t start = now_ns();
+        if (op == OP_APPEND) {
+            do_write(wa, NO_REGION);
+        }
+        else {
+            // only regions this process can see for sure: the initial ones and its own appends
+            const uint64_t total = __atomic_load_n(&sh->total_regions, __ATOMIC_ACQUIRE);
+            uint64_t region = (r >> 8) % total;
+            while (region >= INITIAL_REGIONS && (sh->owner[region] != wa->proc_idx || __atomic_load_n(&sh->committed[region], __ATOMIC_ACQUIRE) == 0)) {
+                region = (region * 7 + 3) % INITIAL_REGIONS;
+            }
+            if (op == OP_WRITE) {
+                while (sh->owner[region] != wa->proc_idx) region = (region + 1) % INITIAL_REGIONS;
+                do_write(wa, region);
+            }
+            else {
+                do_read(wa, region);
+            }
+        }
+        ++st->ops[op];
+        ++st->latency[latency_bucket(now_ns() - start)];
+    }
+    const uint64_t end = now_ns();
+    uint64_t cur = __atomic_load_n(&sh->first_start, __ATOMIC_RELAXED);
+    while (begin < cur && !__atomic_compare_exchange_n(&sh->first_start, &cur, begin, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    cur = __atomic_load_n(&sh->last_end, __ATOMIC_RELAXED);
+    while (end > cur && !__atomic_compare_exchange_n(&sh->last_end, &cur, end, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return NULL;
+}
+
+static int worker_proc(shared_state *sh, int proc_idx, int num_threads, size_t ops, unsigned seed) {
+    zc_file *file = zc_open(path);
+    if (file == NULL) {
+        printf("Worker process %d: zc_open failed\n", proc_idx);
+        return ZC_OPEN_FAILED;
+    }
+    pthread_mutex_t seek_lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_t *threads = malloc(sizeof(pthread_t) * num_threads);
+    worker_args *args = malloc(sizeof(worker_args) * num_threads);
+    for (int t = 0; t != num_threads; ++t) {
+        const int worker_idx = proc_idx * num_threads + t;
+        args[t] = (worker_args){sh, file, &seek_lock, proc_idx, worker_idx, ops, seed * 2654435761ull + worker_idx + 1};
+        pthread_create(&threads[t], NULL, worker_thread, &args[t]);
+    }
+    for (int t = 0; t != num_threads; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+    zc_close(file);
+    free(args);
+    free(threads);
+    return 0;
+}
+
+static void check_child(int pid, int status, int *errcode) {
+    if (WIFSIGNALED(status)) {
+        printf("Child [pid = %d] terminated abruptly!\n", pid);
+        if (*errcode == 0) *errcode = 128 + WTERMSIG(status);
+    }
+    else if (!WIFEXITED(status)) {
+        printf("Child [pid = %d] terminated abruptly!\n", pid);
+        if (*errcode == 0) *errcode = 8;
+    }
+    else if (WEXITSTATUS(status) == ZC_OPEN_FAILED) {
+        if (*errcode == 0) *errcode = ZC_OPEN_FAILED;
+    }
+    else if (WEXITSTATUS(status) != 0) {
+        printf("Child [pid = %d] returned weird error code!\n", pid);
+        if (*errcode == 0) *errcode = 97;
+    }
+}
+
+// checks every region with plain pread, independently of the submission
+static int final_check(shared_state *sh) {
+    const int fd = open(path, O_RDONLY);
+    char buf[REGION];
+    for (uint64_t region = 0; region != sh->total_regions; ++region) {
+        if (sh->committed[region] == 0) continue;
+        const uint64_t version = pread(fd, buf, REGION, region * REGION) == REGION ? check_record(buf, region) : 0;
+        if (version != sh->committed[region]) {
+            printf("Region %lu has version %lu after the run, expected %lu\n", (unsigned long)region, (unsigned long)version, (unsigned long)sh->committed[region]);
+            close(fd);
+            return 1;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+static int run_level(int num_proc, int num_threads, size_t ops, unsigned seed) {
+    const int num_workers = num_proc * num_threads;
+    const size_t max_regions = INITIAL_REGIONS + (size_t)num_workers * ops;
+    const size_t bytes = sizeof(shared_state) + max_regions * (2 * sizeof(uint64_t) + sizeof(int)) + num_workers * sizeof(worker_stats);
+    char *mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    assert(mem != MAP_FAILED);
+    shared_state *sh = (shared_state *)mem;
+    sh->committed = (uint64_t *)(mem + sizeof(shared_state));
+    sh->versions = sh->committed + max_regions;
+    sh->stats = (worker_stats *)(sh->versions + max_regions);
+    sh->owner = (int *)(sh->stats + num_workers);
+    sh->total_regions = INITIAL_REGIONS;
+    sh->first_start = UINT64_MAX;
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&sh->append_lock, &mattr);
+
+    // initial content, written without zc_io
+    const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    char buf[REGION];
+    for (uint64_t region = 0; region != INITIAL_REGIONS; ++region) {
+        write_record(buf, region, 1);
+        pwrite(fd, buf, REGION, region * REGION);
+        sh->committed[region] = sh->versions[region] = 1;
+        sh->owner[region] = region % num_proc;
+    }
+    close(fd);
+
+    fflush(stdout);
+    for (int p = 0; p != num_proc; ++p) {
+        const int res = fork();
+        assert(res != -1);
+        if (res == 0) {
+            exit(worker_proc(sh, p, num_threads, ops, seed));
+        }
+    }
+
+    // start once every worker is ready; a process that exits before then (e.g. zc_open failed
+    // or it crashed) would leave the others waiting forever, so it aborts the level instead
+    int errcode = 0;
+    int reaped = 0;
+    while (__atomic_load_n(&sh->ready, __ATOMIC_ACQUIRE) != (uint32_t)num_workers) {
+        int status;
+        const int pid = waitpid(-1, &status, WNOHANG);
+        if (pid > 0) {
+            check_child(pid, status, &errcode);
+            ++reaped;
+            break;
+        }
+        nanosleep(&(struct timespec){0, 100000}, NULL);
+    }
+    __atomic_store_n(&sh->start, reaped == 0 ? START_GO : START_ABORT, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &sh->start, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+
+    for (int p = reaped; p != num_proc; ++p) {
+        int status;
+        int pid;
+        if ((pid = wait(&status)) == -1) {
+            printf("Child mysteriously disappeared\n");
+            if (errcode == 0) errcode = 4;
+        }
+        else {
+            check_child(pid, status, &errcode);
+        }
+    }
+    const double secs = sh->last_end > sh->first_start ? (sh->last_end - sh->first_start) / 1e9 : 1e-9;
+    if (errcode == 0) errcode = sh->errcode;
+    if (errcode == 0) errcode = final_check(sh);
+
+    worker_stats total = {0};
+    for (int w = 0; w != num_workers; ++w) {
+        for (int op = 0; op != 3; ++op) total.ops[op] += sh->stats[w].ops[op];
+        total.skipped += sh->stats[w].skipped;
+        for (int b = 0; b != LATENCY_BUCKETS; ++b) total.latency[b] += sh->stats[w].latency[b];
+    }
+    const uint64_t all_ops = total.ops[OP_READ] + total.ops[OP_WRITE] + total.ops[OP_APPEND];
+    const double quantiles[3] = {0.5, 0.99, 0.999};
+    uint64_t quantile_ns[3] = {0};
+    for (int q = 0; q != 3; ++q) {
+        for (uint64_t seen = 0, i = 0; i != LATENCY_BUCKETS; ++i) {
+            seen += total.latency[i];
+            if (seen >= quantiles[q] * all_ops) {
+                quantile_ns[q] = bucket_value(i);
+                break;
+            }
+        }
+    }
+    printf("%d,%d,%.0f,%.1f,%.1f,%.1f,%.1f,%lu,%d\n", num_proc, num_threads, all_ops / secs, all_ops * (double)REGION / 1e6 / secs,
+           quantile_ns[0] / 1e3, quantile_ns[1] / 1e3, quantile_ns[2] / 1e3, (unsigned long)total.skipped, errcode);
+    fflush(stdout);
+
+    pthread_mutex_destroy(&sh->append_lock);
+    munmap(mem, bytes);
+    unlink(path);
+    return errcode;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("usage: %s max_threads max_processes [ops_per_thread=2000] [seed] [dir=/dev/shm]\n", argv[0]);
+        return 1; // run failed
+    }
+    const int max_threads = atoi(argv[1]);
+    const int max_proc = atoi(argv[2]);
+    const size_t ops = argc > 3 ? strtoull(argv[3], NULL, 10) : 2000;
+    unsigned seed = argc > 4 ? atoi(argv[4]) : 0;
+    if (seed == 0) seed = time(NULL);
+    const char *dir = argc > 5 ? argv[5] : "/dev/shm";
+    snprintf(path, sizeof(path), "%s/zcio-stress.%d", dir, (int)getpid());
+
+    assert(max_threads > 0 && max_proc > 0 && max_proc <= INITIAL_REGIONS && ops > 0);
+
+    int errcode = 0;
+    printf("processes,threads,ops/s,MB/s,p50_us,p99_us,p999_us,skipped_reads,result\n");
+    for (int num_proc = 1; num_proc <= max_proc && errcode == 0; num_proc *= 2) {
+        for (int num_threads = 1; num_threads <= max_threads && errcode == 0; num_threads *= 2) {
+            errcode = run_level(num_proc, num_threads, ops, seed);
+        }
+    }
+    return errcode;
+}
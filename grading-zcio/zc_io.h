@@ -0,0 +1,27 @@
+#ifndef ZC_IO_H
+#define ZC_IO_H
+
+// The zc_io API from the lab handout, which submissions implement in zc_io.c.
+
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef struct zc_file zc_file;
+
+/* Exercise 1: Basic zero-copy API */
+zc_file *zc_open(const char *path);
+int zc_close(zc_file *file);
+const char *zc_read_start(zc_file *file, size_t *size);
+void zc_read_end(zc_file *file);
+
+/* Exercise 2: Zero-copy writing */
+char *zc_write_start(zc_file *file, size_t size);
+void zc_write_end(zc_file *file);
+
+/* Exercise 3: Repositioning the file offset */
+off_t zc_lseek(zc_file *file, long offset, int whence);
+
+/* Exercise 5: File copying */
+int zc_copyfile(const char *source, const char *dest);
+
+#endif
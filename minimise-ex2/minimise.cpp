@@ -0,0 +1,232 @@
+/**
+ * Delta-debugging minimiser for failing ex2 test cases.
+ *
+ * Given a test.in on which a compiled grader_ex2 fails (non-zero exit code,
+ * or a transcript that differs from the reference simulator), this repeatedly
+ * removes chunks of instructions, regenerates the expected transcript with sim2
+ * and reruns the grader, until no single instruction can be removed without
+ * the failure disappearing (ddmin, complement-only).
+ * All candidates of one partition are evaluated in parallel, one grader run per
+ * worker, and the smallest-index interesting candidate is taken so the result
+ * does not depend on scheduling.
+ *
+ * Usage (from a stage directory that contains grader_ex2 and sim2):
+ *   minimise first_space subsequent_space ./grader_ex2 ./sim2 test.in minimal.in [disallow_insufficient_space] [jobs] [same_exit_code]
+ */
+#include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+using namespace std;
+constexpr int INST_CONNECT = 0;
+constexpr int INST_DISCONNECT = 1;
+constexpr int INST_READ = 2;
+constexpr int INST_ALLOC = 3;
+constexpr int INST_FREE = 4;
+constexpr const char* GRADER_TIMEOUT = "10s";
+struct instruction {
+    int type;
+    size_t p, b, s;
+};
+struct trace {
+    size_t P, S, B;
+    vector<instruction> prologue, body, epilogue; // connects, everything else, disconnects
+};
+struct outcome {
+    bool valid;   // the simulator accepted the trace
+    int status;   // grader exit code (128 + signal if it was killed)
+    bool differs; // grader transcript differs from the simulator's
+    bool failing() const { return valid && (status != 0 || differs); }
+};
+struct config {
+    string grader, sim, front_space, mid_space, disallow, workdir;
+    bool same_exit;
+};
+trace read_trace(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    trace t;
+    if (fscanf(f, "%zu%zu%zu", &t.P, &t.S, &t.B) != 3) {
+        fprintf(stderr, "%s: bad header\n", path);
+        exit(EXIT_FAILURE);
+    }
+    instruction inst{};
+    while (fscanf(f, "%d%zu", &inst.type, &inst.p) == 2) {
+        inst.b = inst.s = 0;
+        if (inst.type == INST_READ || inst.type == INST_FREE) fscanf(f, "%zu", &inst.b);
+        if (inst.type == INST_ALLOC) fscanf(f, "%zu%zu", &inst.b, &inst.s);
+        if (inst.type == INST_CONNECT && t.body.empty()) t.prologue.push_back(inst);
+        else if (inst.type == INST_DISCONNECT) t.epilogue.push_back(inst);
+        else t.body.push_back(inst);
+    }
+    fclose(f);
+    return t;
+}
+void write_inst(FILE* f, const instruction& inst) {
+    switch (inst.type) {
+        case INST_READ:
+        case INST_FREE: fprintf(f, "%d %zu %zu\n", inst.type, inst.p, inst.b); break;
+        case INST_ALLOC: fprintf(f, "%d %zu %zu %zu\n", inst.type, inst.p, inst.b, inst.s); break;
+        default: fprintf(f, "%d %zu\n", inst.type, inst.p); break;
+    }
+}
+// Writes the trace made of the given body instructions, after dropping every
+// instruction whose object is not in the right state (e.g. reads and frees of an
+// object whose alloc was removed), so that every candidate is well-formed.
+vector<size_t> write_candidate(const char* path, const trace& t, const vector<size_t>& keep) {
+    vector<size_t> kept;
+    unordered_set<size_t> live;
+    FILE* f = fopen(path, "w");
+    fprintf(f, "%zu %zu %zu\n", t.P, t.S, t.B);
+    for (const auto& inst : t.prologue) write_inst(f, inst);
+    for (size_t i : keep) {
+        const instruction& inst = t.body[i];
+        if (inst.type == INST_ALLOC) {
+            if (!live.insert(inst.b).second) continue;
+        }
+        else if (inst.type == INST_READ || inst.type == INST_FREE) {
+            if (!live.count(inst.b)) continue;
+            if (inst.type == INST_FREE) live.erase(inst.b);
+        }
+        write_inst(f, inst);
+        kept.push_back(i);
+    }
+    for (const auto& inst : t.epilogue) write_inst(f, inst);
+    fclose(f);
+    return kept;
+}
+// Runs argv with stdin/stdout redirected, returning the exit code the way a shell reports it.
+int run(const vector<string>& args, const string& in, const string& out) {
+    vector<char*> argv;
+    for (const auto& a : args) argv.push_back(const_cast<char*>(a.c_str()));
+    argv.push_back(nullptr);
+    const pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        const int in_fd = open(in.c_str(), O_RDONLY);
+        const int out_fd = open(out.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        const int null_fd = open("/dev/null", O_WRONLY);
+        if (in_fd == -1 || out_fd == -1 || null_fd == -1) _exit(127);
+        dup2(in_fd, STDIN_FILENO);
+        dup2(out_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+string slurp(const string& path) {
+    ifstream f(path, ios::binary);
+    return string(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+}
+outcome evaluate(const config& cfg, const string& in, size_t slot) {
+    const string expected = cfg.workdir + "/sim" + to_string(slot) + ".out";
+    const string student = cfg.workdir + "/student" + to_string(slot) + ".out";
+    if (run({cfg.sim, cfg.front_space, cfg.mid_space, "999999999", cfg.disallow}, in, expected) != 0) {
+        return {false, 0, false};
+    }
+    const int status = run({"timeout", "--signal=KILL", GRADER_TIMEOUT, cfg.grader}, in, student);
+    return {true, status, slurp(expected) != slurp(student)};
+}
+bool same_failure(const outcome& a, const outcome& b) {
+    return a.status == b.status && (a.status != 0 || a.differs == b.differs);
+}
+int main(int argc, char** argv) {
+    if (argc < 7) {
+        printf("%s first_space subsequent_space grader_ex2 sim2 test.in minimal.in [disallow_insufficient_space] [jobs] [same_exit_code]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    char workdir[] = "/tmp/minimise-ex2.XXXXXX";
+    if (!mkdtemp(workdir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    config cfg{argv[3], argv[4], argv[1], argv[2], (argc > 7 && argv[7][0] == '1') ? "1" : "0", workdir, argc > 9 && argv[9][0] == '1'};
+    size_t jobs = thread::hardware_concurrency();
+    if (argc > 8) sscanf(argv[8], "%zu", &jobs);
+    jobs = max<size_t>(jobs, 1);
+    const trace t = read_trace(argv[5]);
+
+    vector<size_t> current(t.body.size());
+    iota(current.begin(), current.end(), 0);
+    const string original_in = cfg.workdir + "/original.in";
+    current = write_candidate(original_in.c_str(), t, current);
+    const outcome original = evaluate(cfg, original_in, 0);
+    if (!original.failing()) {
+        fprintf(stderr, original.valid ? "The grader does not fail on this test case\n" : "The simulator rejects this test case\n");
+        return EXIT_FAILURE;
+    }
+    auto interesting = [&](const outcome& o) {
+        return o.failing() && (!cfg.same_exit || same_failure(o, original));
+    };
+    fprintf(stderr, "Original: %zu instructions, grader exit code %d%s\n", current.size(), original.status, original.differs ? ", transcript differs" : "");
+
+    size_t n = 2, max_n = 0, rounds = 0, runs = 1;
+    while (current.size() >= 2) {
+        n = min(n, current.size());
+        max_n = max(max_n, n);
+        // candidates[k] is current without its k-th chunk
+        vector<vector<size_t>> candidates(n);
+        vector<string> paths(n);
+        for (size_t k = 0; k != n; ++k) {
+            const size_t lo = current.size() * k / n, hi = current.size() * (k + 1) / n;
+            candidates[k].insert(candidates[k].end(), current.begin(), current.begin() + lo);
+            candidates[k].insert(candidates[k].end(), current.begin() + hi, current.end());
+            paths[k] = cfg.workdir + "/cand" + to_string(k) + ".in";
+            candidates[k] = write_candidate(paths[k].c_str(), t, candidates[k]);
+        }
+        vector<char> result(n, 0);
+        atomic<size_t> next{0};
+        vector<thread> workers;
+        for (size_t w = 0; w != min(jobs, n); ++w) {
+            workers.emplace_back([&, w] {
+                for (size_t k; (k = next++) < n;) {
+                    result[k] = interesting(evaluate(cfg, paths[k], w + 1));
+                }
+            });
+        }
+        for (auto& w : workers) w.join();
+        runs += n;
+        ++rounds;
+        // re-check serially: concurrent graders may have raced each other for the same shm name
+        size_t found = n;
+        for (size_t k = 0; k != n && found == n; ++k) {
+            if (result[k] && interesting(evaluate(cfg, paths[k], 0))) found = k;
+            runs += result[k];
+        }
+        if (found != n) {
+            current = candidates[found];
+            n = max<size_t>(n - 1, 2);
+        }
+        else if (n < current.size()) {
+            n = min(n * 2, current.size());
+        }
+        else {
+            break;
+        }
+        fprintf(stderr, "Round %zu: %zu instructions left\n", rounds, current.size());
+    }
+
+    write_candidate(argv[6], t, current);
+    const outcome final_outcome = evaluate(cfg, argv[6], 0);
+    fprintf(stderr, "Minimal: %zu instructions (%zu grader runs), grader exit code %d%s\n", current.size(), runs + 1, final_outcome.status, final_outcome.differs ? ", transcript differs" : "");
+    for (size_t slot = 0; slot <= jobs; ++slot) {
+        unlink((cfg.workdir + "/sim" + to_string(slot) + ".out").c_str());
+        unlink((cfg.workdir + "/student" + to_string(slot) + ".out").c_str());
+    }
+    for (size_t k = 0; k != max_n; ++k) {
+        unlink((cfg.workdir + "/cand" + to_string(k) + ".in").c_str());
+    }
+    unlink(original_in.c_str());
+    rmdir(cfg.workdir.c_str());
+    return EXIT_SUCCESS;
+}
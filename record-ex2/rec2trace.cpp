@@ -0,0 +1,168 @@
+/**
+ * Turns a recording of recorder.so into an ex2 trace (test.in) for grader_ex2
+ * and sim2, so that allocators can be replayed on real workloads.
+ *
+ * Threads become processes in the order they first appear (folded modulo
+ * max_processes if that is given), and every block gets the lowest object id
+ * that is free at the time it is allocated, so B is the peak number of live
+ * blocks. Sizes are rounded up to words. Unless reads_before_free is 0, every
+ * free is preceded by a read of the object by the same process, so replays
+ * check that the data survived. Frees of blocks allocated before recording
+ * started are dropped.
+ *
+ * S is the smallest multiple of the page size in which first fit (as in sim2,
+ * with the given bookkeeping space) never runs out of room. Where first fit
+ * would leave a remainder too small to be a chunk, which the generator never
+ * does and sim2 rejects, the allocation is grown to fill its chunk exactly.
+ *
+ * Usage:
+ *   rec2trace first_space subsequent_space recording test.in [max_processes=0] [reads_before_free=1]
+ * and then ./sim2 first_space subsequent_space < test.in > test.out as usual.
+ */
+#include <bits/stdc++.h>
+#include "../dynspace-ex2/placement.hpp"
+#include "record.h"
+using namespace std;
+constexpr int INST_CONNECT = 0;
+constexpr int INST_DISCONNECT = 1;
+constexpr int INST_READ = 2;
+constexpr int INST_ALLOC = 3;
+constexpr int INST_FREE = 4;
+constexpr size_t PAGE_SIZE = 4096;
+constexpr size_t ALLOWANCE = 256; // the bytes sim2 and gen2 keep free at the end for ex4
+struct instruction {
+    int type;
+    size_t p, b, s;
+};
+// First fit on a treap, with a peek at the block an allocation would go to.
+struct replay_heap : first_fit_tree {
+    using first_fit_tree::first_fit_tree;
+    // length (header included) of the block first fit puts len words in, or 0 if none fits
+    size_t first_fit_len(size_t len) {
+        const size_t off = tree.first_fit(len + mid_space, 0, searched);
+        return off == NO_SPACE ? 0 : blocks.at(off).len;
+    }
+};
+vector<rec_event> read_recording(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    uint64_t magic = 0;
+    if (fread(&magic, sizeof(magic), 1, f) != 1 || magic != REC_MAGIC) {
+        fprintf(stderr, "%s is not a recording\n", path);
+        exit(EXIT_FAILURE);
+    }
+    vector<rec_event> events;
+    rec_event ev;
+    while (fread(&ev, sizeof(ev), 1, f) == 1) events.push_back(ev);
+    fclose(f);
+    sort(events.begin(), events.end(), [](const rec_event& a, const rec_event& b) { return a.seq < b.seq; });
+    return events;
+}
+// Replays the allocations through first fit on S words, growing those that would leave
+// a remainder too small for a chunk; returns false if some allocation does not fit.
+bool place(vector<instruction>& body, size_t S, size_t mid_space, size_t B) {
+    replay_heap heap(S, mid_space);
+    vector<size_t> idx(B);
+    for (auto& inst : body) {
+        if (inst.type == INST_ALLOC) {
+            const size_t fit = heap.first_fit_len(inst.s);
+            if (fit == 0) return false;
+            if (fit > inst.s + mid_space && fit <= inst.s + 2 * mid_space) inst.s = fit - mid_space;
+            idx[inst.b] = heap.allocate(inst.s);
+        }
+        else if (inst.type == INST_FREE) {
+            heap.release(idx[inst.b]);
+        }
+    }
+    return true;
+}
+int main(int argc, char** argv) {
+    if (argc < 5) {
+        printf("%s first_space subsequent_space recording test.in [max_processes=0] [reads_before_free=1]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    size_t front_space, mid_space;
+    sscanf(argv[1], "%zu", &front_space);
+    sscanf(argv[2], "%zu", &mid_space);
+    const size_t max_processes = argc > 5 ? strtoull(argv[5], nullptr, 10) : 0;
+    const bool reads = !(argc > 6 && argv[6][0] == '0');
+    assert(front_space % sizeof(size_t) == 0);
+    assert(mid_space % sizeof(size_t) == 0);
+    front_space -= mid_space;
+    mid_space /= sizeof(size_t);
+
+    const vector<rec_event> events = read_recording(argv[3]);
+    unordered_map<uint32_t, size_t> process_of;
+    unordered_map<uint64_t, size_t> object_at; // address -> object id
+    priority_queue<size_t, vector<size_t>, greater<size_t>> spare_ids;
+    size_t B = 0;
+    size_t dropped = 0;
+    vector<instruction> body;
+    for (const auto& ev : events) {
+        const auto proc = process_of.emplace(ev.thread, process_of.size()).first;
+        const size_t p = max_processes ? proc->second % max_processes : proc->second;
+        if (ev.op == REC_MALLOC) {
+            size_t b;
+            if (spare_ids.empty()) {
+                b = B++;
+            }
+            else {
+                b = spare_ids.top();
+                spare_ids.pop();
+            }
+            // a block at an address that is still live was freed behind the recorder's back; it stays allocated
+            object_at[ev.ptr] = b;
+            body.push_back({INST_ALLOC, p, b, max<size_t>(1, (ev.size + sizeof(size_t) - 1) / sizeof(size_t))});
+        }
+        else {
+            auto it = object_at.find(ev.ptr);
+            if (it == object_at.end()) {
+                ++dropped;
+                continue;
+            }
+            if (reads) body.push_back({INST_READ, p, it->second});
+            body.push_back({INST_FREE, p, it->second});
+            spare_ids.push(it->second);
+            object_at.erase(it);
+        }
+    }
+    const size_t P = max<size_t>(1, max_processes ? min(max_processes, process_of.size()) : process_of.size());
+    B = max<size_t>(B, 1);
+
+    // the first pass with unbounded room finds the footprint, which later passes grow until everything fits
+    vector<instruction> placed = body;
+    size_t extent = 0;
+    {
+        replay_heap heap(size_t(1) << 48, mid_space);
+        vector<size_t> idx(B);
+        for (const auto& inst : body) {
+            if (inst.type == INST_ALLOC) extent = max(extent, (idx[inst.b] = heap.allocate(inst.s)) + inst.s);
+            else if (inst.type == INST_FREE) heap.release(idx[inst.b]);
+        }
+    }
+    size_t S_bytes = (front_space + extent * sizeof(size_t) + ALLOWANCE + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    while (true) {
+        placed = body;
+        if (place(placed, (S_bytes - front_space - ALLOWANCE) / sizeof(size_t), mid_space, B)) break;
+        S_bytes += PAGE_SIZE;
+    }
+
+    FILE* out = fopen(argv[4], "w");
+    if (!out) {
+        perror(argv[4]);
+        return EXIT_FAILURE;
+    }
+    fprintf(out, "%zu %zu %zu\n", P, S_bytes, B);
+    for (size_t p=0; p!=P; ++p) fprintf(out, "%d %zu\n", INST_CONNECT, p);
+    for (const auto& inst : placed) {
+        if (inst.type == INST_ALLOC) fprintf(out, "%d %zu %zu %zu\n", inst.type, inst.p, inst.b, inst.s);
+        else fprintf(out, "%d %zu %zu\n", inst.type, inst.p, inst.b);
+    }
+    for (size_t p=0; p!=P; ++p) fprintf(out, "%d %zu\n", INST_DISCONNECT, p);
+    fclose(out);
+    fprintf(stderr, "%zu events, %zu threads, P=%zu S=%zu B=%zu, %zu frees of unknown blocks dropped\n",
+            events.size(), process_of.size(), P, S_bytes, B, dropped);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+Format of the recordings written by recorder.c and read by rec2trace: the
+64-bit REC_MAGIC, then rec_events in no particular order. Each thread's
+events are in the order of its calls, and seq orders all of them.
+*/
+
+#define REC_MAGIC 0x31306365726d6873ull // "shmrec01"
+
+enum { REC_MALLOC = 0, REC_FREE = 1 };
+
+typedef struct {
+    uint64_t seq;
+    uint64_t ptr;
+    uint64_t size;   // requested bytes, 0 for frees
+    uint32_t op;     // REC_MALLOC or REC_FREE
+    uint32_t thread; // index of the calling thread, in the order of their first recorded call
+} rec_event;
@@ -0,0 +1,282 @@
+/**
+ * LD_PRELOAD recorder of the malloc/calloc/realloc/free calls of a program,
+ * and of the aligned allocations (posix_memalign, aligned_alloc, memalign,
+ * valloc, pvalloc), whose output rec2trace turns into an ex2 trace (test.in).
+ *
+ * Every thread appends its calls to its own single-producer ring, so the
+ * hooks take no locks; a background thread drains all rings to the output
+ * file every few milliseconds. Calls are ordered by a global sequence number,
+ * taken after malloc returns and before free runs, so a block freed by one
+ * thread and handed out to another is always freed first. A thread whose ring
+ * is full waits for the drain instead of dropping calls. realloc is recorded
+ * as a free of the old block and a malloc of the new one, and every aligned
+ * allocation as a malloc of the requested size. Forked children are not
+ * recorded (they have no draining thread), and calls made after the
+ * recorder's destructor has run are lost. Neither are calls that do not go
+ * through these symbols, e.g. glibc's reallocarray (which calls its realloc
+ * internally) or allocators that take their arenas straight from mmap.
+ *
+ * Build and use it as:
+ *   gcc -std=c99 -O2 -shared -fPIC -D_GNU_SOURCE recorder.c -o recorder.so -ldl -lpthread
+ *   SHMHEAP_RECORD=alloc.rec LD_PRELOAD=./recorder.so ./program
+ * which writes alloc.rec.<pid> (SHMHEAP_RECORD defaults to "alloc.rec").
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "record.h"
+
+#define RING_EVENTS (1 << 14)
+#define DRAIN_INTERVAL_NS 5000000
+#define BOOTSTRAP_SIZE 4096
+
+typedef struct ring {
+    struct ring *next;
+    uint32_t thread;
+    uint64_t head __attribute__((aligned(64))); // written by the draining thread
+    uint64_t tail __attribute__((aligned(64))); // written by the owning thread
+    rec_event events[RING_EVENTS];
+} ring;
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void*, size_t);
+static void (*real_free)(void*);
+static int (*real_posix_memalign)(void**, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+static void *(*real_valloc)(size_t);
+static void *(*real_pvalloc)(size_t);
+
+// dlsym itself may allocate before the real functions are known
+static char bootstrap[BOOTSTRAP_SIZE] __attribute__((aligned(16)));
+static size_t bootstrap_used;
+static int resolving;
+
+static ring *rings; // every ring ever created, newest first
+static uint64_t next_seq;
+static uint32_t next_thread;
+static int recording;
+static int draining;
+static int out_fd = -1;
+static pthread_t drain_thread;
+
+static __thread ring *my_ring __attribute__((tls_model("initial-exec")));
+static __thread int in_hook __attribute__((tls_model("initial-exec")));
+
+static void *bootstrap_alloc(size_t size) {
+    size = (size + 15) / 16 * 16;
+    if (bootstrap_used + size > BOOTSTRAP_SIZE) return NULL;
+    void *p = bootstrap + bootstrap_used;
+    bootstrap_used += size;
+    return p;
+}
+
+static int is_bootstrap(const void *p) {
+    return (const char*)p >= bootstrap && (const char*)p < bootstrap + BOOTSTRAP_SIZE;
+}
+
+static void resolve(void) {
+    resolving = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+    real_valloc = dlsym(RTLD_NEXT, "valloc");
+    real_pvalloc = dlsym(RTLD_NEXT, "pvalloc");
+    resolving = 0;
+}
+
+// Rings are mmapped and never freed, so they outlive their threads until the final drain.
+static ring *new_ring(void) {
+    ring *r = mmap(NULL, sizeof(ring), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED) return NULL;
+    r->thread = __atomic_fetch_add(&next_thread, 1, __ATOMIC_RELAXED);
+    r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rings, &r->next, r, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return r;
+}
+
+static uint64_t take_seq(void) {
+    return __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+}
+
+static void record(uint32_t op, uint64_t seq, const void *ptr, size_t size) {
+    ring *r = my_ring;
+    if (r == NULL && (r = my_ring = new_ring()) == NULL) return;
+    const uint64_t tail = r->tail;
+    while (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == RING_EVENTS) {
+        if (!__atomic_load_n(&draining, __ATOMIC_RELAXED)) return;
+        sched_yield();
+    }
+    rec_event *ev = &r->events[tail % RING_EVENTS];
+    ev->seq = seq;
+    ev->ptr = (uintptr_t)ptr;
+    ev->size = size;
+    ev->op = op;
+    ev->thread = r->thread;
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static int should_record(void) {
+    return __atomic_load_n(&recording, __ATOMIC_RELAXED) && !in_hook;
+}
+
+static void drain_all(void) {
+    for (ring *r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+        const uint64_t head = r->head;
+        const uint64_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        for (uint64_t pos = head; pos != tail;) {
+            // the part up to the end of the array, then the part that wrapped around
+            const uint64_t n = tail - pos < RING_EVENTS - pos % RING_EVENTS ? tail - pos : RING_EVENTS - pos % RING_EVENTS;
+            if (write(out_fd, &r->events[pos % RING_EVENTS], n * sizeof(rec_event)) == -1) break;
+            pos += n;
+        }
+        __atomic_store_n(&r->head, tail, __ATOMIC_RELEASE);
+    }
+}
+
+static void *drain_proc(void *arg) {
+    in_hook = 1; // nothing this thread allocates is part of the program
+    const struct timespec interval = {0, DRAIN_INTERVAL_NS};
+    while (__atomic_load_n(&draining, __ATOMIC_ACQUIRE)) {
+        drain_all();
+        nanosleep(&interval, NULL);
+    }
+    return arg;
+}
+
+static void stop_in_child(void) {
+    recording = 0;
+    draining = 0;
+}
+
+__attribute__((constructor)) static void recorder_start(void) {
+    if (real_malloc == NULL) resolve();
+    in_hook = 1;
+    const char *path = getenv("SHMHEAP_RECORD");
+    char name[4096];
+    snprintf(name, sizeof(name), "%s.%d", path != NULL && path[0] != '\0' ? path : "alloc.rec", (int)getpid());
+    out_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out_fd != -1) {
+        const uint64_t magic = REC_MAGIC;
+        write(out_fd, &magic, sizeof(magic));
+        draining = 1;
+        if (pthread_create(&drain_thread, NULL, drain_proc, NULL) == 0) {
+            pthread_atfork(NULL, NULL, stop_in_child);
+            recording = 1;
+        }
+        else {
+            draining = 0;
+        }
+    }
+    in_hook = 0;
+}
+
+__attribute__((destructor)) static void recorder_stop(void) {
+    if (!recording) return;
+    __atomic_store_n(&recording, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&draining, 0, __ATOMIC_RELEASE);
+    pthread_join(drain_thread, NULL);
+    drain_all();
+    close(out_fd);
+}
+
+void *malloc(size_t size) {
+    if (real_malloc == NULL) {
+        if (resolving) return bootstrap_alloc(size);
+        resolve();
+    }
+    void *p = real_malloc(size);
+    if (p != NULL && should_record()) record(REC_MALLOC, take_seq(), p, size);
+    return p;
+}
+
+void *calloc(size_t count, size_t size) {
+    if (real_calloc == NULL) {
+        // bootstrap memory is static, so it is already zeroed
+        if (resolving) return bootstrap_alloc(count * size);
+        resolve();
+    }
+    void *p = real_calloc(count, size);
+    if (p != NULL && should_record()) record(REC_MALLOC, take_seq(), p, count * size);
+    return p;
+}
+
+void *realloc(void *old, size_t size) {
+    if (is_bootstrap(old)) {
+        void *p = malloc(size);
+        if (p != NULL) memcpy(p, old, size < BOOTSTRAP_SIZE ? size : BOOTSTRAP_SIZE);
+        return p;
+    }
+    if (real_realloc == NULL) resolve();
+    if (!should_record()) return real_realloc(old, size);
+    // the old block may be reused by another thread as soon as realloc releases it
+    const uint64_t free_seq = old != NULL ? take_seq() : 0;
+    void *p = real_realloc(old, size);
+    if (p == NULL && size != 0) return p; // failed, the old block is still there
+    if (old != NULL) record(REC_FREE, free_seq, old, 0);
+    if (p != NULL) record(REC_MALLOC, take_seq(), p, size);
+    return p;
+}
+
+void free(void *p) {
+    if (p == NULL || is_bootstrap(p)) return;
+    if (real_free == NULL) resolve();
+    if (should_record()) record(REC_FREE, take_seq(), p, 0);
+    real_free(p);
+}
+
+// The aligned allocators are not used by dlsym, so they need no bootstrap; a C library
+// without one of them makes it fail as if out of memory.
+
+int posix_memalign(void **out, size_t alignment, size_t size) {
+    if (real_posix_memalign == NULL) resolve();
+    if (real_posix_memalign == NULL) return ENOMEM;
+    const int res = real_posix_memalign(out, alignment, size);
+    if (res == 0 && should_record()) record(REC_MALLOC, take_seq(), *out, size);
+    return res;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    if (real_aligned_alloc == NULL) resolve();
+    void *p = real_aligned_alloc != NULL ? real_aligned_alloc(alignment, size) : NULL;
+    if (p != NULL && should_record()) record(REC_MALLOC, take_seq(), p, size);
+    return p;
+}
+
+void *memalign(size_t alignment, size_t size) {
+    if (real_memalign == NULL) resolve();
+    void *p = real_memalign != NULL ? real_memalign(alignment, size) : NULL;
+    if (p != NULL && should_record()) record(REC_MALLOC, take_seq(), p, size);
+    return p;
+}
+
+void *valloc(size_t size) {
+    if (real_valloc == NULL) resolve();
+    void *p = real_valloc != NULL ? real_valloc(size) : NULL;
+    if (p != NULL && should_record()) record(REC_MALLOC, take_seq(), p, size);
+    return p;
+}
+
+void *pvalloc(size_t size) {
+    if (real_pvalloc == NULL) resolve();
+    void *p = real_pvalloc != NULL ? real_pvalloc(size) : NULL;
+    if (p != NULL && should_record()) record(REC_MALLOC, take_seq(), p, size);
+    return p;
+}
@@ -4,99 +4,146 @@
 # Expects grader files in ./grading-ex1/
 
 
-filter_str=$1
+# script.sh --worker <index> <zip> [baseline] grades a single submission, see launch_worker
+# script.sh --serve [filter] runs the grading service, script.sh --status [name] queries it, see serve
+if [[ $1 == --worker ]]
+then
+    worker_index=$2
+    worker_zip=$3
+    worker_mode=$4
+elif [[ $1 == --serve || $1 == --status ]]
+then
+    service_mode=${1#--}
+    filter_str=$2
+else
+    filter_str=$1
+fi
 
 # nullglob, so that empty directories will not be iterated
 shopt -s nullglob
 
-# Print a header line
-echo "Name,1_1_nounmap,1_2_nounmap,1_1_eqloc,1_2_eqloc,1_1,1_2,2_1_noinsf,2_2_noinsf,2_3_noinsf,2_1_nounmap,2_2_nounmap,2_3_nounmap,2_1_eqloc,2_2_eqloc,2_3_eqloc,2_1,2_2,2_3,"
+# Correctness grading uses unoptimised debug builds. Performance-oriented modes
+# use an optimised build instead (PERF_LTO=1 adds link-time optimisation between
+# shmheap.c and the grader), and their results go to a separate CSV, $PERF_CSV.
+DEBUG_CFLAGS="-std=c99 -w -g -D_POSIX_C_SOURCE=200809L -D_GNU_SOURCE"
+PERF_CFLAGS="-std=c99 -w -O2 -march=native -D_POSIX_C_SOURCE=200809L -D_GNU_SOURCE"
+PERF_PROFILE="O2-native"
+if [[ $PERF_LTO == 1 ]]
+then
+    PERF_CFLAGS="$PERF_CFLAGS -flto"
+    PERF_PROFILE="$PERF_PROFILE-lto"
+fi
+export PERF_CSV=$(realpath -m "${PERF_CSV:-perf.csv}")
+
+# Submissions are graded by worker processes, up to $JOBS at a time. With
+# GRADE_ISOLATE=1 (the default when unshare works) every worker gets its own IPC
+# and mount namespace with a private tmpfs of $SHM_SIZE on /dev/shm, so one
+# submission can neither see nor exhaust another's segments, and all of them go
+# away with the namespace. Workers are also put in memory and pids cgroups
+# limited to $MEM_LIMIT and $PIDS_LIMIT where the cgroup filesystem allows.
+JOBS=${JOBS:-1}
+SHM_SIZE=${SHM_SIZE:-256m}
+MEM_LIMIT=${MEM_LIMIT:-1G}
+PIDS_LIMIT=${PIDS_LIMIT:-1024}
+script_path=$(realpath "$0")
+root_dir=$(pwd)
+
+# The grading service (script.sh --serve) keeps everything in $SERVICE_DIR: results.csv
+# (every row it graded, with when and which version of the zip), perf.csv, the cache of
+# test cases, the stage directories, and the queue and running jobs shown by --status.
+SERVICE_DIR=$(realpath -m "${SERVICE_DIR:-service}")
+
+CSV_HEADER="Name,1_1_nounmap,1_2_nounmap,1_1_eqloc,1_2_eqloc,1_1,1_2,2_1_noinsf,2_2_noinsf,2_3_noinsf,2_1_nounmap,2_2_nounmap,2_3_nounmap,2_1_eqloc,2_2_eqloc,2_3_eqloc,2_1,2_2,2_3,"
+if [[ -z $worker_index && -z $service_mode ]]
+then
+    echo "Name,profile,2_complexity," > "$PERF_CSV"
+
+    # Print a header line
+    echo "$CSV_HEADER"
+fi
 
 function tester()
 {
     return 5
 }
-function compile_ex1()
+# Compiles $1.c with build profile $2 (debug or perf) into $1.$2.o, reusing the
+# object if this stage already built it
+function build_object()
 {
-    rm grader_ex1 2>/dev/null
-    # Compile the code
-    if [[ -z $(gcc -std=c99 -w -g -D_POSIX_C_SOURCE=200809L -D_GNU_SOURCE shmheap.c grader_ex1.c -lpthread -lrt -o grader_ex1 2>&1) && -f grader_ex1 ]]
+    if [[ -f $1.$2.o ]]
     then
         return 0
-    else
-        return 99 # error (compilation failed)
     fi
-}
-function compile_ex1_eqloc()
-{
-    rm grader_ex1 2>/dev/null
-    # Compile the code
-    if [[ -z $(gcc -std=c99 -w -g -D_POSIX_C_SOURCE=200809L -D_GNU_SOURCE shmheap.c grader_ex1_eqloc.c -lpthread -lrt -o grader_ex1 2>&1) && -f grader_ex1 ]]
+    cflags=$DEBUG_CFLAGS
+    if [[ $2 == perf ]]
+    then
+        cflags=$PERF_CFLAGS
+    fi
+    if [[ -z $(gcc $cflags -c $1.c -o $1.$2.o 2>&1) && -f $1.$2.o ]]
     then
         return 0
     else
+        rm $1.$2.o 2>/dev/null
         return 99 # error (compilation failed)
     fi
 }
-function compile_ex1_nounmap()
+# Links the executable $3 from the $2 profile objects of shmheap.c and $1.c
+function link_grader()
 {
-    rm grader_ex1 2>/dev/null
-    # Compile the code
-    if [[ -z $(gcc -std=c99 -w -g -D_POSIX_C_SOURCE=200809L -D_GNU_SOURCE shmheap.c grader_ex1_nounmap.c -lpthread -lrt -o grader_ex1 2>&1) && -f grader_ex1 ]]
+    rm $3 2>/dev/null
+    build_object shmheap $2 || return 99
+    build_object $1 $2 || return 99
+    cflags=$DEBUG_CFLAGS
+    if [[ $2 == perf ]]
+    then
+        cflags=$PERF_CFLAGS
+    fi
+    if [[ -z $(gcc $cflags shmheap.$2.o $1.$2.o -lpthread -lrt -lm -o $3 2>&1) && -f $3 ]]
     then
         return 0
     else
         return 99 # error (compilation failed)
     fi
 }
+function compile_ex1()
+{
+    link_grader grader_ex1 debug grader_ex1
+    return $?
+}
+function compile_ex1_eqloc()
+{
+    link_grader grader_ex1_eqloc debug grader_ex1
+    return $?
+}
+function compile_ex1_nounmap()
+{
+    link_grader grader_ex1_nounmap debug grader_ex1
+    return $?
+}
 function compile_ex2()
 {
-    rm grader_ex2 2>/dev/null
-    # Compile the code
-    if [[ -z $(gcc -std=c99 -w -g -D_POSIX_C_SOURCE=200809L -D_GNU_SOURCE shmheap.c grader_ex2.c -lpthread -lrt -o grader_ex2 2>&1) && -f grader_ex2 ]]
-    then
-        return 0
-    else
-        return 99 # error (compilation failed)
-    fi
+    link_grader grader_ex2 debug grader_ex2
+    return $?
 }
 function compile_ex2_eqloc()
 {
-    rm grader_ex2 2>/dev/null
-    # Compile the code
-    if [[ -z $(gcc -std=c99 -w -g -D_POSIX_C_SOURCE=200809L -D_GNU_SOURCE shmheap.c grader_ex2_eqloc.c -lpthread -lrt -o grader_ex2 2>&1) && -f grader_ex2 ]]
-    then
-        return 0
-    else
-        return 99 # error (compilation failed)
-    fi
+    link_grader grader_ex2_eqloc debug grader_ex2
+    return $?
 }
 function compile_ex2_nounmap()
 {
-    rm grader_ex2 2>/dev/null
-    # Compile the code
-    if [[ -z $(gcc -std=c99 -w -g -D_POSIX_C_SOURCE=200809L -D_GNU_SOURCE shmheap.c grader_ex2_nounmap.c -lpthread -lrt -o grader_ex2 2>&1) && -f grader_ex2 ]]
-    then
-        return 0
-    else
-        return 99 # error (compilation failed)
-    fi
+    link_grader grader_ex2_nounmap debug grader_ex2
+    return $?
 }
 function compile_ex3()
 {
-    rm grader_ex3 2>/dev/null
-    # Compile the code
-    if [[ -z $(gcc -std=c99 -w -g -D_POSIX_C_SOURCE=200809L -D_GNU_SOURCE shmheap.c grader_ex3.c -lpthread -lrt -o grader_ex3 2>&1) && -f grader_ex3 ]]
-    then
-        return 0
-    else
-        return 99 # error (compilation failed)
-    fi
+    link_grader grader_ex3 debug grader_ex3
+    return $?
 }
 function prod_ex()
 {
     # Compile the code
-    if [[ -z $(gcc -std=c99 -w -g -D_POSIX_C_SOURCE=200809L -D_GNU_SOURCE shmheap.c prodder.c -lpthread -lrt -o prodder 2>&1) && -f prodder ]]
+    if link_grader prodder debug prodder
     then
         $(timeout --signal=KILL 10s ./prodder prod.txt 1>/dev/null 2>/dev/null)
         args=($(<prod.txt))
@@ -122,6 +169,40 @@ function prod_ex()
         return 99 # error (compilation failed)
     fi
 }
+function probe_ex()
+{
+    rm complexity.txt 2>/dev/null
+    # Compile the code with the optimised profile, since this one is about timing
+    if link_grader complexity_probe perf complexity_probe
+    then
+        $(timeout --signal=KILL 30s ./complexity_probe complexity.txt 1>/dev/null 2>/dev/null)
+        probe_result=$?
+        if ! [[ $probe_result -eq 0 ]]
+        then
+            return $probe_result
+        fi
+        complexity=$(<complexity.txt)
+        return 0
+    else
+        return 99 # error (compilation failed)
+    fi
+}
+
+# Every test gets its own SHMHEAP_RUN_ID, which the graders put in the names of
+# their heaps (/shmheap-<id>-<i>). Once the test is over, whatever segments it
+# left behind (submissions that crashed before shmheap_destroy, dummies of killed
+# children) are unlinked, so /dev/shm does not fill up over a whole cohort.
+test_counter=0
+function run_test()
+{
+    test_counter=$((test_counter + 1))
+    export SHMHEAP_RUN_ID="$GRADE_MAIN_PID-$worker_index-$test_counter"
+    "$@"
+    test_result=$?
+    rm -f /dev/shm/shmheap-$SHMHEAP_RUN_ID-* 2>/dev/null
+    unset SHMHEAP_RUN_ID
+    return $test_result
+}
 
 # Function to do grading for a single exercises
 # Returns 0 on success, nonzero on error
@@ -145,41 +226,72 @@ function grade_ex2()
 {
     test_index=$1
     disallow_insufficient_space=$2
-    rm test.in 2>/dev/null
-    rm test.out 2>/dev/null
-    rm sim.out 2>/dev/null
-    rm student.out 2>/dev/null
     case $test_index in
         1)
-            $(./gen2 $first_space $mid_space 20 496058235 test.in test.out $disallow_insufficient_space)
+            gen_args="20 496058235"
             ;;
         2)
-            $(./gen2 $first_space $mid_space 100 786423160 test.in test.out $disallow_insufficient_space)
+            gen_args="100 786423160"
             ;;
         3)
-            $(./gen2 $first_space $mid_space 1000 1985435896 test.in test.out $disallow_insufficient_space)
+            gen_args="1000 1985435896"
             ;;
         *)
             Message="Invalid test index"
+            return 100
             ;;
     esac
-    if ! [[ $? -eq 0 ]]
+    # With GRADE_VERIFY=1, grader_ex2 checks every result against the reference model as it
+    # goes and stops at the first wrong one, so a submission that returns a wrong offset and
+    # crashes later gets 1 rather than the crash's code (the graders built from the _eqloc and
+    # _nounmap variants ignore the arguments)
+    verify_args=
+    if [[ $GRADE_VERIFY == 1 ]]
     then
-        echo "Ex2 generator or simulator is not working"
-        return 100
+        verify_args="$first_space $mid_space"
     fi
-    $(./sim2 $first_space $mid_space 999999999 $disallow_insufficient_space < test.in > sim.out)
-    if ! [[ $? -eq 0 ]]
+    if [[ $GRADE_STREAM == 1 ]]
     then
-        echo "Ex2 generator or simulator is not working"
-        return 100
+        stream_ex2
+        return $?
     fi
-    if ! cmp -s "test.out" "sim.out"
+    rm test.in 2>/dev/null
+    rm test.out 2>/dev/null
+    rm sim.out 2>/dev/null
+    rm student.out 2>/dev/null
+    # With $GRADE_CACHE set (as the grading service does), a test case is generated and checked
+    # against sim2 once for every bookkeeping space, and copied from the cache after that
+    cache_key="$GRADE_CACHE/ex2-$first_space-$mid_space-${gen_args// /-}-${disallow_insufficient_space:-0}"
+    if [[ -n $GRADE_CACHE && -f $cache_key.in && -f $cache_key.out ]]
     then
-        echo "Ex2 generator or simulator is not working"
-        return 100
+        cp "$cache_key.in" test.in
+        cp "$cache_key.out" test.out
+    else
+        $(./gen2 $first_space $mid_space $gen_args test.in test.out $disallow_insufficient_space)
+        if ! [[ $? -eq 0 ]]
+        then
+            echo "Ex2 generator or simulator is not working"
+            return 100
+        fi
+        $(./sim2 $first_space $mid_space 999999999 $disallow_insufficient_space < test.in > sim.out)
+        if ! [[ $? -eq 0 ]]
+        then
+            echo "Ex2 generator or simulator is not working"
+            return 100
+        fi
+        if ! cmp -s "test.out" "sim.out"
+        then
+            echo "Ex2 generator or simulator is not working"
+            return 100
+        fi
+        if [[ -n $GRADE_CACHE ]]
+        then
+            # renamed into place, so concurrent workers never see half a test case
+            cp test.in "$cache_key.in.$$" && mv "$cache_key.in.$$" "$cache_key.in"
+            cp test.out "$cache_key.out.$$" && mv "$cache_key.out.$$" "$cache_key.out"
+        fi
     fi
-    $(timeout --signal=KILL 10s ./grader_ex2 < test.in > student.out 2>/dev/null)
+    $(timeout --signal=KILL 10s ./grader_ex2 $verify_args < test.in > student.out 2>/dev/null)
     ex2_result=$?
     # echo "Res: $ex2_result"
     if ! [[ $ex2_result -eq 0 ]]
@@ -193,6 +305,50 @@ function grade_ex2()
         return 1
     fi
 }
+# With GRADE_STREAM=1, grade_ex2 runs gen2, sim2, grader_ex2 and streamcmp at
+# the same time, connected by FIFOs: the trace goes from gen2 through tee to
+# both sim2 and grader_ex2, and streamcmp checks both transcripts against
+# gen2's while they are produced, so no trace or transcript is ever written to
+# disk. tee -p keeps feeding sim2 after a grader that stopped early or was killed.
+function stream_ex2()
+{
+    rm -f gen.in gen.out sim.in sim.out student.out 2>/dev/null
+    if ! mkfifo gen.in gen.out sim.in sim.out student.out
+    then
+        echo "Ex2 generator or simulator is not working"
+        return 100
+    fi
+    ./gen2 $first_space $mid_space $gen_args gen.in gen.out $disallow_insufficient_space > /dev/null 2>&1 &
+    gen_pid=$!
+    ./sim2 $first_space $mid_space 999999999 $disallow_insufficient_space < sim.in > sim.out 2>/dev/null &
+    sim_pid=$!
+    tee -p sim.in < gen.in 2>/dev/null | timeout --signal=KILL 10s ./grader_ex2 $verify_args > student.out 2>/dev/null &
+    grader_pid=$!
+    ./streamcmp -s gen.out sim.out student.out
+    cmp_result=$?
+    wait $gen_pid
+    gen_result=$?
+    wait $sim_pid
+    sim_result=$?
+    wait $grader_pid
+    ex2_result=$?
+    rm -f gen.in gen.out sim.in sim.out student.out
+    # streamcmp exits with 1 if sim2 disagrees with gen2, 2 if grader_ex2 does
+    if [[ $gen_result -ne 0 || $sim_result -ne 0 || $cmp_result -ne 0 && $cmp_result -ne 2 ]]
+    then
+        echo "Ex2 generator or simulator is not working"
+        return 100
+    fi
+    if ! [[ $ex2_result -eq 0 ]]
+    then
+        return $ex2_result
+    fi
+    if [[ $cmp_result -eq 2 ]]
+    then
+        return 1
+    fi
+    return 0
+}
 function grade_ex3()
 {
     test_index=$1
@@ -213,85 +369,206 @@ function grade_ex3()
     return $?
 }
 
-# Prep the generator
-if ! [[ -z $(g++ -std=c++17 -w -O3 gen-ex2/gen.cpp -o gen2 2>&1) && -f gen2 ]]
-then
-    echo "Ex2 generator failed to compile"
-fi
-
-# Prep the generator
-if ! [[ -z $(g++ -std=c++17 -w -O3 dynspace-ex2/simulate.cpp -o sim2 2>&1) && -f sim2 ]]
-then
-    echo "Ex2 validator failed to compile"
-fi
+# Runs the complexity probe in the stage directory and appends its row to the perf CSV
+function record_perf_row()
+{
+    # Complexity probe (records the class, e.g. O(n), or an error code)
+    run_test probe_ex
+    probe_result=$?
+    if ! [[ $probe_result -eq 0 ]]
+    then
+        complexity=$probe_result
+    fi
+    # one write, so rows from parallel workers do not interleave
+    echo "$STUDENT_NAME,$PERF_PROFILE,$complexity," >> "$PERF_CSV"
+}
 
-# Loop through all the student submissions
-for f in ./submissions/*
-do
-    # If it is a zip file
-    if [[ $f == *.zip && $f == *$filter_str* ]]
+# Grades the submission $1 in the directory $2, printing its CSV row. With $3 = baseline it
+# prints no row and only adds the submission's row to the perf CSV, which is how the reference
+# implementation becomes the baseline of the benchmark reports without appearing in the grade
+# sheet; it still runs every grader, and returns 1 if any test did not pass.
+function grade_submission()
+{
+    f=$1
+    stage=$2
+    FILE_NAME_ONLY=$(basename "$f")
+    STUDENT_NAME=${FILE_NAME_ONLY%% - *}
+    # Create an empty directory for compilation and evaluation
+    yes | rm -rf "$stage" 1>/dev/null 2>/dev/null
+    mkdir -p "$stage"
+    # Unzip the student directory (the reference implementation is a plain directory)
+    if [[ -d $f ]]
     then
-        # Echo the student name
-        FILE_NAME_ONLY=$(basename "$f")
-        STUDENT_NAME=${FILE_NAME_ONLY%% - *}
-        echo -n "$STUDENT_NAME,"
-        # Create an empty directory for compilation and evaluation
-        yes | rm -rf stage 1>/dev/null 2>/dev/null
-        mkdir stage
-        # Unzip the student directory
-        unzip "$f" -d ./stage > /dev/null
-        # If the code is in a nested directory, flatten the directory structure
-        while true
+        cp "$f"/shmheap.* "$stage"
+    else
+        unzip "$f" -d "$stage" > /dev/null
+    fi
+    # If the code is in a nested directory, flatten the directory structure
+    while true
+    do
+        for f2 in "$stage"/*
         do
-            for f2 in ./stage/*
-            do
-                if [[ "$f2" == *"ex4"* ]]
-                then
-                    # ignore all ex4 code
-                    rm -r "$f2" 1>&2
-                elif [[ -d $f2 ]]
+            if [[ "$f2" == *"ex4"* ]]
+            then
+                # ignore all ex4 code
+                rm -r "$f2" 1>&2
+            elif [[ -d $f2 ]]
+            then
+                set -- "$f2/"*
+                if [[ $# -gt 0 ]]
                 then
-                    set -- "$f2/"*
-                    if [[ $# -gt 0 ]]
-                    then
-                        mv -v "${f2}/"* ./stage/ 1>&2
-                    fi
-                    yes | rm -r "$f2" 1>&2
-                    continue 2
+                    mv -v "${f2}/"* "$stage"/ 1>&2
                 fi
-            done
-            break
+                yes | rm -r "$f2" 1>&2
+                continue 2
+            fi
         done
-        # Remove anything that isn't shmheap.*
-        for f2 in ./stage/*
+        break
+    done
+    # Remove anything that isn't shmheap.*
+    for f2 in "$stage"/*
+    do
+        if [[ $f2 != */shmheap.* ]]
+        then
+            yes | rm "$f2" 1>&2
+        fi
+    done
+    # Copy the grader files
+    cp ./grading-ex1/* "$stage"
+    cp ./grading-ex2/* "$stage"
+    cp ./grading-ex3/* "$stage"
+    cp ./gen2 "$stage"
+    cp ./sim2 "$stage"
+    cp ./streamcmp "$stage"
+    # Go into the stage directory
+    cd "$stage"
+
+    if [[ $3 == baseline ]]
+    then
+        # the reference must pass every grader, but it gets no row in the grade sheet
+        grade_cells > baseline_cells
+        cells=$(<baseline_cells)
+        baseline_status=0
+        if [[ $cells == *[!0,]* ]]
+        then
+            echo "The reference implementation failed the graders: $cells" 1>&2
+            baseline_status=1
+        fi
+        record_perf_row
+        cd "$root_dir"
+        yes | rm -rf "$stage" 1>&2
+        return $baseline_status
+    fi
+
+    # Echo the student name
+    echo -n "$STUDENT_NAME,"
+    grade_cells
+    record_perf_row
+    
+    # Go out of the stage directory
+    cd "$root_dir"
+    # Remove the stage directory
+    yes | rm -rf "$stage" 1>&2
+    
+    # Print newline
+    echo ""
+}
+
+# Compiles and runs every grader in the stage directory, printing the result of each test
+# as one cell of the submission's CSV row
+function grade_cells()
+{
+    # Ex1 has 2 tests
+    max_test_index=2
+    
+    # Compile the student's code
+    compile_ex1_nounmap
+    compile_result=$?
+    
+    # Test 1
+    for ((i=1;i<=max_test_index;i++))
+    do
+        if [[ $compile_result -eq 0 ]]
+        then
+            run_test grade_ex1 $i
+            RESULT=$?
+        else
+            RESULT=$compile_result
+        fi
+        echo -n "$RESULT,"
+    done
+    
+    # Compile the student's code
+    compile_ex1_eqloc
+    compile_result=$?
+    
+    # Test 1
+    for ((i=1;i<=max_test_index;i++))
+    do
+        if [[ $compile_result -eq 0 ]]
+        then
+            run_test grade_ex1 $i
+            RESULT=$?
+        else
+            RESULT=$compile_result
+        fi
+        echo -n "$RESULT,"
+    done
+    
+    # Compile the student's code
+    compile_ex1
+    compile_result=$?
+    
+    # Test 1
+    for ((i=1;i<=max_test_index;i++))
+    do
+        if [[ $compile_result -eq 0 ]]
+        then
+            run_test grade_ex1 $i
+            RESULT=$?
+        else
+            RESULT=$compile_result
+        fi
+        echo -n "$RESULT,"
+    done
+    
+    # Prodder (test 2 and 3, sets start_space and mid_space)
+    run_test prod_ex
+    prod_result=$?
+    compile_result=$prod_result
+    
+    # Ex2 has 3 tests
+    max_test_index=3
+    
+    if [[ $compile_result -eq 0 ]]
+    then
+        # Compile the student's code
+        compile_ex2
+        compile_result=$?
+    
+        # Test 2
+        for ((i=1;i<=max_test_index;i++))
         do
-            if [[ $f2 != */shmheap.* ]]
+            if [[ $compile_result -eq 0 ]]
             then
-                yes | rm "$f2" 1>&2
+                run_test grade_ex2 $i 1
+                RESULT=$?
+            else
+                RESULT=$compile_result
             fi
+            echo -n "$RESULT,"
         done
-        # Copy the grader files
-        cp ./grading-ex1/* ./stage
-        cp ./grading-ex2/* ./stage
-        cp ./grading-ex3/* ./stage
-        cp ./gen2 ./stage
-        cp ./sim2 ./stage
-        # Go into the stage directory
-        cd stage
-        
-        # Ex1 has 2 tests
-        max_test_index=2
         
         # Compile the student's code
-        compile_ex1_nounmap
+        compile_ex2_nounmap
         compile_result=$?
-        
-        # Test 1
+    
+        # Test 2
         for ((i=1;i<=max_test_index;i++))
         do
             if [[ $compile_result -eq 0 ]]
             then
-                grade_ex1 $i
+                run_test grade_ex2 $i
                 RESULT=$?
             else
                 RESULT=$compile_result
@@ -300,15 +577,15 @@ do
         done
         
         # Compile the student's code
-        compile_ex1_eqloc
+        compile_ex2_eqloc
         compile_result=$?
-        
-        # Test 1
+    
+        # Test 2
         for ((i=1;i<=max_test_index;i++))
         do
             if [[ $compile_result -eq 0 ]]
             then
-                grade_ex1 $i
+                run_test grade_ex2 $i
                 RESULT=$?
             else
                 RESULT=$compile_result
@@ -317,15 +594,15 @@ do
         done
         
         # Compile the student's code
-        compile_ex1
+        compile_ex2
         compile_result=$?
-        
-        # Test 1
+    
+        # Test 2
         for ((i=1;i<=max_test_index;i++))
         do
             if [[ $compile_result -eq 0 ]]
             then
-                grade_ex1 $i
+                run_test grade_ex2 $i
                 RESULT=$?
             else
                 RESULT=$compile_result
@@ -333,114 +610,393 @@ do
             echo -n "$RESULT,"
         done
         
-        # Prodder (test 2 and 3, sets start_space and mid_space)
-        prod_ex
-        prod_result=$?
-        compile_result=$prod_result
-        
-        # Ex2 has 3 tests
-        max_test_index=3
-        
-        if [[ $compile_result -eq 0 ]]
+        # Compile the student's code
+        compile_ex3
+        compile_result=$?
+    
+        # Test 3
+        for ((i=1;i<=max_test_index;i++))
+        do
+            if [[ $compile_result -eq 0 ]]
+            then
+                run_test grade_ex3 $i
+                RESULT=$?
+            else
+                RESULT=$compile_result
+            fi
+            echo -n "$RESULT,"
+        done
+    else
+        for ((i=1;i<=max_test_index;i++))
+        do
+            echo -n "$compile_result,$compile_result,$compile_result,$compile_result,$compile_result,"
+        done
+    fi
+}
+
+# Creates memory and pids cgroups named $1 with the worker limits, and prints
+# their directories; whatever cannot be created or limited is left out, with a warning
+function make_cgroups()
+{
+    if [[ -f /sys/fs/cgroup/cgroup.controllers ]]
+    then
+        # on cgroup v2 both limits live in one cgroup, whose controllers the parent must enable
+        for controller in memory pids
+        do
+            if ! grep -qw "$controller" /sys/fs/cgroup/cgroup.subtree_control 2>/dev/null
+            then
+                echo "The $controller controller is not enabled in /sys/fs/cgroup, grading without cgroup limits" 1>&2
+                return
+            fi
+        done
+        d=/sys/fs/cgroup/$1
+        if ! mkdir "$d" 2>/dev/null
         then
-            # Compile the student's code
-            compile_ex2
-            compile_result=$?
-        
-            # Test 2
-            for ((i=1;i<=max_test_index;i++))
-            do
-                if [[ $compile_result -eq 0 ]]
-                then
-                    grade_ex2 $i 1
-                    RESULT=$?
-                else
-                    RESULT=$compile_result
-                fi
-                echo -n "$RESULT,"
-            done
-            
-            # Compile the student's code
-            compile_ex2_nounmap
-            compile_result=$?
-        
-            # Test 2
-            for ((i=1;i<=max_test_index;i++))
-            do
-                if [[ $compile_result -eq 0 ]]
-                then
-                    grade_ex2 $i
-                    RESULT=$?
-                else
-                    RESULT=$compile_result
-                fi
-                echo -n "$RESULT,"
-            done
-            
-            # Compile the student's code
-            compile_ex2_eqloc
-            compile_result=$?
-        
-            # Test 2
-            for ((i=1;i<=max_test_index;i++))
-            do
-                if [[ $compile_result -eq 0 ]]
-                then
-                    grade_ex2 $i
-                    RESULT=$?
-                else
-                    RESULT=$compile_result
-                fi
-                echo -n "$RESULT,"
-            done
-            
-            # Compile the student's code
-            compile_ex2
-            compile_result=$?
-        
-            # Test 2
-            for ((i=1;i<=max_test_index;i++))
+            echo "Cannot create cgroup $d, grading without cgroup limits" 1>&2
+        elif ! echo "$MEM_LIMIT" 2>/dev/null > "$d/memory.max" || ! echo "$PIDS_LIMIT" 2>/dev/null > "$d/pids.max"
+        then
+            echo "Cannot set the limits of cgroup $d, grading without cgroup limits" 1>&2
+            rmdir "$d"
+        else
+            echo "$d"
+        fi
+        return
+    fi
+    for controller in memory pids
+    do
+        parent=/sys/fs/cgroup/$controller$(sed -n "s/^[0-9]*:$controller:\(.*\)/\1/p" /proc/self/cgroup)
+        d=${parent%/}/$1
+        if [[ $controller == memory ]]
+        then
+            file=memory.limit_in_bytes
+            limit=$MEM_LIMIT
+        else
+            file=pids.max
+            limit=$PIDS_LIMIT
+        fi
+        if ! mkdir "$d" 2>/dev/null
+        then
+            echo "Cannot create cgroup $d, grading without a $controller limit" 1>&2
+        elif ! echo "$limit" 2>/dev/null > "$d/$file"
+        then
+            echo "Cannot set $file of cgroup $d, grading without a $controller limit" 1>&2
+            rmdir "$d"
+        else
+            echo "$d"
+        fi
+    done
+}
+# Kills whatever is still running in the cgroups $@ and removes them
+function remove_cgroups()
+{
+    for d in "$@"
+    do
+        for ((attempt=0;attempt!=50;attempt++))
+        do
+            pids=$(cat "$d/cgroup.procs" 2>/dev/null)
+            if [[ -z $pids ]]
+            then
+                break
+            fi
+            kill -9 $pids 2>/dev/null
+            sleep 0.1
+        done
+        rmdir "$d" 2>/dev/null
+    done
+}
+# Grades the submission $2 as worker number $1 (in mode $3, see grade_submission),
+# isolated if GRADE_ISOLATE=1
+function launch_worker()
+{
+    cgroups=($(make_cgroups "shmheap-grade-$$-$1"))
+    if [[ $GRADE_ISOLATE == 1 ]]
+    then
+        GRADE_CGROUPS="${cgroups[*]}" unshare --ipc --mount --fork bash "$script_path" --worker "$1" "$2" "$3"
+    else
+        GRADE_CGROUPS="${cgroups[*]}" bash "$script_path" --worker "$1" "$2" "$3"
+    fi
+    worker_status=$?
+    remove_cgroups "${cgroups[@]}"
+    return $worker_status
+}
+
+# Grades every zip in ./submissions that is new or changed since the service last graded
+# it, and then every zip that is written to or moved into ./submissions, until stopped with
+# SIGINT or SIGTERM. gen2 and sim2 are built, and the test cases generated, once for the
+# whole lifetime of the service rather than once per batch. Up to $JOBS zips are graded at a
+# time, the oldest queued first; a zip that changes while it is graded is queued again.
+function serve()
+{
+    mkdir -p "$SERVICE_DIR/running" "$SERVICE_DIR/cache"
+    if [[ -f $SERVICE_DIR/pid ]] && kill -0 $(<"$SERVICE_DIR/pid") 2>/dev/null
+    then
+        echo "The grading service is already running in $SERVICE_DIR" 1>&2
+        return 1
+    fi
+    echo $$ > "$SERVICE_DIR/pid"
+    rm -f "$SERVICE_DIR/running/"* "$SERVICE_DIR/queue"
+    export GRADE_CACHE="$SERVICE_DIR/cache"
+    export GRADE_STAGE_DIR="$SERVICE_DIR/stage"
+    export PERF_CSV="$SERVICE_DIR/perf.csv"
+    if ! [[ -f $PERF_CSV ]]
+    then
+        echo "Name,profile,2_complexity," > "$PERF_CSV"
+        launch_worker baseline ./shmheap-ref baseline
+    fi
+    results="$SERVICE_DIR/results.csv"
+    if ! [[ -f $results ]]
+    then
+        echo "time,file,sha1,$CSV_HEADER" > "$results"
+    fi
+    # the sha1 of the version of every zip that was graded last
+    declare -A graded
+    while IFS=, read -r graded_time name sha row
+    do
+        graded[$name]=$sha
+    done < <(tail -n +2 "$results")
+
+    coproc WATCH { exec ./watchdir ./submissions; }
+    service_stopping=0
+    trap 'service_stopping=1' INT TERM
+    pending=()      # names of the queued zips, oldest first
+    declare -A busy # slot -> name of the zip it is grading
+    echo "Grading service started in $SERVICE_DIR with $JOBS workers"
+    while [[ $service_stopping -eq 0 ]]
+    do
+        if read -t 1 -u "${WATCH[0]}" name
+        then
+            queued=0
+            for p in "${pending[@]}"
             do
-                if [[ $compile_result -eq 0 ]]
+                if [[ $p == "$name" ]]
                 then
-                    grade_ex2 $i
-                    RESULT=$?
-                else
-                    RESULT=$compile_result
+                    queued=1
                 fi
-                echo -n "$RESULT,"
             done
-            
-            # Compile the student's code
-            compile_ex3
-            compile_result=$?
-        
-            # Test 3
-            for ((i=1;i<=max_test_index;i++))
+            if [[ $queued -eq 0 && $name == *.zip && $name == *$filter_str* ]]
+            then
+                pending+=("$name")
+            fi
+        elif [[ $? -le 128 && $service_stopping -eq 0 ]]
+        then
+            echo "Lost the watch on ./submissions" 1>&2
+            break
+        fi
+        # a job removes its running file once its row is stored
+        for slot in "${!busy[@]}"
+        do
+            if ! [[ -f $SERVICE_DIR/running/$slot ]]
+            then
+                echo "Graded ${busy[$slot]}"
+                unset "busy[$slot]"
+            fi
+        done
+        for ((slot=0; slot!=JOBS && ${#pending[@]}!=0; slot++))
+        do
+            if [[ -n ${busy[$slot]} ]]
+            then
+                continue
+            fi
+            # the oldest queued zip that is not being graded right now
+            for ((i=0; i!=${#pending[@]}; i++))
             do
-                if [[ $compile_result -eq 0 ]]
+                name=${pending[$i]}
+                for b in "${busy[@]}"
+                do
+                    if [[ $b == "$name" ]]
+                    then
+                        continue 2
+                    fi
+                done
+                pending=("${pending[@]:0:$i}" "${pending[@]:$((i + 1))}")
+                sha=$(sha1sum < "./submissions/$name" 2>/dev/null)
+                sha=${sha%% *}
+                if [[ -z $sha || ${graded[$name]} == "$sha" ]]
                 then
-                    grade_ex3 $i
-                    RESULT=$?
-                else
-                    RESULT=$compile_result
+                    # deleted, or the same as last time, so the next one moved up to index i
+                    i=$((i - 1))
+                    continue
                 fi
-                echo -n "$RESULT,"
+                graded[$name]=$sha
+                busy[$slot]=$name
+                echo "$(date +%s) $sha $name" > "$SERVICE_DIR/running/$slot"
+                echo "Grading $name"
+                (
+                    trap - INT TERM
+                    row=$(launch_worker "$slot" "./submissions/$name")
+                    # one write, so rows from parallel workers do not interleave
+                    echo "$(date +%s),$name,$sha,$row" >> "$results"
+                    rm -f "$SERVICE_DIR/running/$slot"
+                ) &
+                break
             done
+        done
+        printf '%s\n' "${pending[@]}" > "$SERVICE_DIR/queue.tmp"
+        mv "$SERVICE_DIR/queue.tmp" "$SERVICE_DIR/queue"
+    done
+
+    echo "Grading service stopping, waiting for ${#busy[@]} running jobs"
+    kill $WATCH_PID 2>/dev/null
+    wait
+    rm -f "$SERVICE_DIR/pid" "$SERVICE_DIR/queue" "$SERVICE_DIR/running/"*
+    rm -rf "$GRADE_STAGE_DIR"
+    rm -f /dev/shm/shmheap-$$-* 2>/dev/null
+    return 0
+}
+
+# Shows whether the service is running, what it is grading and what is queued, and then
+# the latest result of every submission, or every result of those whose name contains $1
+function show_status()
+{
+    status=0
+    if [[ -f $SERVICE_DIR/pid ]] && kill -0 $(<"$SERVICE_DIR/pid") 2>/dev/null
+    then
+        echo "Grading service running (pid $(<"$SERVICE_DIR/pid")) in $SERVICE_DIR"
+    else
+        echo "Grading service not running in $SERVICE_DIR"
+        status=1
+    fi
+    now=$(date +%s)
+    for job in "$SERVICE_DIR/running/"*
+    do
+        read -r started sha name < "$job"
+        echo "Grading: $name (for $((now - started))s)"
+    done
+    if [[ -f $SERVICE_DIR/queue ]]
+    then
+        while IFS= read -r name
+        do
+            if [[ -n $name ]]
+            then
+                echo "Queued: $name"
+            fi
+        done < "$SERVICE_DIR/queue"
+    fi
+    if [[ -f $SERVICE_DIR/results.csv ]]
+    then
+        head -n 1 "$SERVICE_DIR/results.csv"
+        if [[ -n $filter_str ]]
+        then
+            tail -n +2 "$SERVICE_DIR/results.csv" | awk -F, -v name="$filter_str" 'index($2, name)'
         else
-            for ((i=1;i<=max_test_index;i++))
+            tail -n +2 "$SERVICE_DIR/results.csv" | awk -F, '{ last[$2] = $0 } END { for (f in last) print last[f] }' | sort -t, -k2,2
+        fi
+    fi
+    return $status
+}
+
+if [[ -n $worker_index ]]
+then
+    for d in $GRADE_CGROUPS
+    do
+        if ! echo $$ 2>/dev/null > "$d/cgroup.procs"
+        then
+            echo "Cannot move worker $worker_index into cgroup $d, grading without its limit" 1>&2
+        fi
+    done
+    if [[ $GRADE_ISOLATE == 1 ]]
+    then
+        if ! mount -t tmpfs -o size=$SHM_SIZE,mode=1777 tmpfs /dev/shm
+        then
+            echo "Cannot mount a private /dev/shm for worker $worker_index, grading on the shared one without the $SHM_SIZE limit" 1>&2
+        fi
+    fi
+    grade_submission "$worker_zip" "${GRADE_STAGE_DIR:-stage}/$worker_index" "$worker_mode"
+    exit $?
+fi
+
+if [[ $service_mode == status ]]
+then
+    show_status
+    exit $?
+fi
+
+if [[ -z $GRADE_ISOLATE ]]
+then
+    if unshare --ipc --mount true 2>/dev/null
+    then
+        GRADE_ISOLATE=1
+    else
+        GRADE_ISOLATE=0
+        echo "unshare is not available, grading without namespace isolation" 1>&2
+    fi
+fi
+export GRADE_ISOLATE
+export GRADE_MAIN_PID=$$
+
+# Prep the generator
+if ! [[ -z $(g++ -std=c++17 -w -O3 gen-ex2/gen.cpp -o gen2 2>&1) && -f gen2 ]]
+then
+    echo "Ex2 generator failed to compile"
+fi
+
+# Prep the generator
+if ! [[ -z $(g++ -std=c++17 -w -O3 dynspace-ex2/simulate.cpp -o sim2 2>&1) && -f sim2 ]]
+then
+    echo "Ex2 validator failed to compile"
+fi
+
+# Prep the comparator of streamed transcripts
+if ! [[ -z $(gcc $DEBUG_CFLAGS -O2 grading-ex2/streamcmp.c -o streamcmp 2>&1) && -f streamcmp ]]
+then
+    echo "Ex2 stream comparator failed to compile"
+fi
+
+if [[ $service_mode == serve ]]
+then
+    if ! [[ -z $(gcc $DEBUG_CFLAGS -O2 grading-service/watchdir.c -o watchdir 2>&1) && -f watchdir ]]
+    then
+        echo "Submission watcher failed to compile"
+        exit 1
+    fi
+    serve
+    exit $?
+fi
+
+# Loop through all the student submissions
+yes | rm -rf ./stage > /dev/null
+mkdir -p stage/rows
+num_workers=0
+num_printed=0
+# Prints the rows of finished workers, in submission order
+function print_rows()
+{
+    while [[ $num_printed -lt $num_workers && -f stage/rows/$num_printed.done ]]
+    do
+        cat stage/rows/$num_printed
+        num_printed=$((num_printed + 1))
+    done
+}
+# The reference implementation goes first in the perf CSV, as the baseline of the benchmark reports
+launch_worker baseline ./shmheap-ref baseline
+baseline_status=$?
+for f in ./submissions/*
+do
+    # If it is a zip file
+    if [[ $f == *.zip && $f == *$filter_str* ]]
+    then
+        if [[ $JOBS -le 1 ]]
+        then
+            # print the row as it is graded
+            launch_worker $num_workers "$f"
+        else
+            while [[ $(jobs -rp | wc -l) -ge $JOBS ]]
             do
-                echo -n "$compile_result,$compile_result,$compile_result,$compile_result,$compile_result,"
+                wait -n
+                print_rows
             done
+            (launch_worker $num_workers "$f" > stage/rows/$num_workers; touch stage/rows/$num_workers.done) &
         fi
-        
-        # Go out of the stage directory
-        cd ..
-        # Remove the stage directory
-        yes | rm -rf stage 1>&2
-        
-        # Print newline
-        echo ""
+        num_workers=$((num_workers + 1))
+        print_rows
     fi
 done
+wait
+if [[ $JOBS -gt 1 ]]
+then
+    print_rows
+fi
 yes | rm -rf ./stage > /dev/null
+# Catch anything created after its test's sweep, e.g. by children outliving a killed grader
+rm -f /dev/shm/shmheap-$$-* 2>/dev/null
+exit $baseline_status
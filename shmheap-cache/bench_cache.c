@@ -0,0 +1,295 @@
+/**
+ * This benchmark measures how alloc/free throughput scales with the number
+ * of processes sharing one heap, with and without shmheap_cache in front.
+ * For N = 1, 2, 4, ... up to `max_processes`, every process keeps a window of
+ * WINDOW live objects of random small sizes and replaces one per iteration.
+ * Every SEND_EVERY-th object is not freed by its allocator but sent (as a
+ * handle) to the next process, which checks its contents and frees it, so
+ * blocks constantly move between processes' caches as they do under ex3.
+ * The cache runs share one depot, so magazines also move between processes.
+ * After each run the whole heap must be allocatable again, or a block leaked.
+ *
+ * Build it with any shmheap.c, e.g. from shmheap-ref/:
+ *   gcc -std=c99 -O2 -D_POSIX_C_SOURCE=200809L -D_GNU_SOURCE -I../shmheap-ref \
+ *       ../shmheap-ref/shmheap.c shmheap_cache.c bench_cache.c -lpthread -lrt
+ *
+ * Output is one CSV line per run: processes,mode,ops/s,hit_rate,result
+ * Exit codes follow the shmheap graders: 1 for incorrect data or a leak,
+ * 2 if the heap ran out, 128 + signal if a worker crashed, 97 for a weird
+ * worker exit code.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shmheap.h"
+#include "shmheap_cache.h"
+
+#define MAX_PROCESSES 200
+#define HEAP_SIZE (64 << 20)
+#define WINDOW 16
+#define SEND_EVERY 4
+#define MAILBOX 64
+#define MIN_OBJECT 16
+#define MAX_OBJECT 512
+
+// handles sent to one process; single producer (the previous process), single consumer
+typedef struct {
+    uint64_t head, tail;
+    shmheap_object_handle slots[MAILBOX];
+} mailbox;
+
+// lives in MAP_SHARED memory, so every process of a run sees the same copy
+typedef struct {
+    pthread_barrier_t start, done;
+    uint64_t first_start, last_end; // ns, over all workers
+    uint64_t hits, misses;
+    shmheap_object_handle depot; // of the cache runs
+    mailbox boxes[MAX_PROCESSES];
+} shared_state;
+
+static const char *shm_prefix = "/shmheap";
+
+// names are /shmheap-<id>-<i>, as explained in grading-ex1/grader_ex1.c
+static const char *find_good_shm_name(int *i) {
+    static char run_id[48];
+    if (run_id[0] == '\0') {
+        const char *env = getenv("SHMHEAP_RUN_ID");
+        if (env != NULL && env[0] != '\0') {
+            snprintf(run_id, sizeof(run_id), "%s", env);
+        }
+        else {
+            unsigned int nonce = time(NULL);
+            const int fd = open("/dev/urandom", O_RDONLY);
+            if (fd != -1) {
+                read(fd, &nonce, sizeof(nonce));
+                close(fd);
+            }
+            snprintf(run_id, sizeof(run_id), "%d-%08x", (int)getpid(), nonce);
+        }
+    }
+    char *ret = malloc(80 * sizeof(char));
+    snprintf(ret, 80, "%s-%s-%d", shm_prefix, run_id, (*i)++);
+    return ret;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// what the first word of an object holds, so the receiver can check it got the right one
+static uint64_t tag_of(int proc, size_t op) {
+    return ((uint64_t)proc << 40) ^ (op * 0x9E3779B97F4A7C15ull);
+}
+
+typedef struct {
+    shmheap_memory_handle mem;
+    shmheap_cache *cache; // NULL when running without the cache
+} heap_ref;
+
+static void *obj_alloc(heap_ref *h, size_t sz) {
+    return h->cache != NULL ? shmheap_cache_alloc(h->cache, sz) : shmheap_alloc(h->mem, sz);
+}
+
+static void obj_free(heap_ref *h, void *ptr) {
+    if (h->cache != NULL) shmheap_cache_free(h->cache, ptr);
+    else shmheap_free(h->mem, ptr);
+}
+
+static bool send_handle(mailbox *box, shmheap_object_handle hdl) {
+    const uint64_t tail = __atomic_load_n(&box->tail, __ATOMIC_RELAXED);
+    if (tail - __atomic_load_n(&box->head, __ATOMIC_ACQUIRE) == MAILBOX) return false;
+    box->slots[tail % MAILBOX] = hdl;
+    __atomic_store_n(&box->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// frees everything in the mailbox, returning the number of objects with the wrong contents
+static int drain_mailbox(heap_ref *h, mailbox *box) {
+    int bad = 0;
+    uint64_t head = __atomic_load_n(&box->head, __ATOMIC_RELAXED);
+    const uint64_t tail = __atomic_load_n(&box->tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        uint64_t *data = shmheap_handle_to_ptr(h->mem, box->slots[head % MAILBOX]);
+        // sent objects hold their tag in the first word and its complement in the second
+        if (data[0] != ~data[1]) ++bad;
+        obj_free(h, data);
+    }
+    __atomic_store_n(&box->head, head, __ATOMIC_RELEASE);
+    return bad;
+}
+
+static int worker_proc(const char *mem_name, shared_state *sh, int proc, int num_proc, size_t num_ops, bool use_cache, unsigned int seed) {
+    heap_ref h = {shmheap_connect(mem_name), NULL};
+    if (use_cache) h.cache = shmheap_cache_create(h.mem, shmheap_handle_to_ptr(h.mem, sh->depot));
+    mailbox *const inbox = &sh->boxes[proc];
+    mailbox *const outbox = &sh->boxes[(proc + 1) % num_proc];
+    uint64_t *window[WINDOW] = {NULL};
+    int bad = 0;
+    bool out_of_memory = false;
+
+    pthread_barrier_wait(&sh->start);
+    const uint64_t begin = now_ns();
+    for (size_t i=0; i!=num_ops; ++i) {
+        const size_t slot = rand_r(&seed) % WINDOW;
+        if (window[slot] != NULL) {
+            if (num_proc == 1 || i % SEND_EVERY != 0 || !send_handle(outbox, shmheap_ptr_to_handle(h.mem, window[slot]))) {
+                obj_free(&h, window[slot]);
+            }
+        }
+        const size_t sz = MIN_OBJECT + rand_r(&seed) % (MAX_OBJECT - MIN_OBJECT + 1);
+        uint64_t *obj = obj_alloc(&h, sz);
+        if (obj == NULL) {
+            // the others still wait for this process at the done barrier
+            out_of_memory = true;
+            window[slot] = NULL;
+            break;
+        }
+        obj[0] = tag_of(proc, i);
+        obj[1] = ~obj[0];
+        window[slot] = obj;
+        if (i % WINDOW == 0) bad += drain_mailbox(&h, inbox);
+    }
+    for (size_t slot=0; slot!=WINDOW; ++slot) {
+        if (window[slot] != NULL) {
+            obj_free(&h, window[slot]);
+        }
+    }
+    // nothing is sent after this barrier, so one more drain empties the mailbox for good
+    pthread_barrier_wait(&sh->done);
+    bad += drain_mailbox(&h, inbox);
+    const uint64_t end = now_ns();
+
+    uint64_t cur = __atomic_load_n(&sh->first_start, __ATOMIC_RELAXED);
+    while (begin < cur && !__atomic_compare_exchange_n(&sh->first_start, &cur, begin, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    cur = __atomic_load_n(&sh->last_end, __ATOMIC_RELAXED);
+    while (end > cur && !__atomic_compare_exchange_n(&sh->last_end, &cur, end, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    if (h.cache != NULL) {
+        __atomic_fetch_add(&sh->hits, h.cache->hits, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&sh->misses, h.cache->misses, __ATOMIC_RELAXED);
+        shmheap_cache_destroy(h.cache);
+    }
+    shmheap_disconnect(h.mem);
+    return out_of_memory ? 2 : bad != 0 ? 1 : 0;
+}
+
+static int run(int *name_idx, shared_state *sh, int num_proc, size_t num_ops, bool use_cache) {
+    const char *const mem_name = find_good_shm_name(name_idx);
+    shmheap_memory_handle mem = shmheap_create(mem_name, HEAP_SIZE);
+
+    memset(sh, 0, sizeof(*sh));
+    sh->first_start = UINT64_MAX;
+    shmheap_cache_depot *depot = NULL;
+    if (use_cache) {
+        depot = shmheap_cache_depot_create(mem);
+        assert(depot != NULL);
+        sh->depot = shmheap_ptr_to_handle(mem, depot);
+    }
+    pthread_barrierattr_t attr;
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(&sh->start, &attr, num_proc);
+    pthread_barrier_init(&sh->done, &attr, num_proc);
+    pthread_barrierattr_destroy(&attr);
+
+    fflush(stdout);
+    for (int p=0; p!=num_proc; ++p) {
+        const int res = fork();
+        assert(res != -1);
+        if (res == 0) {
+            exit(worker_proc(mem_name, sh, p, num_proc, num_ops, use_cache, rand() + p));
+        }
+    }
+
+    int errcode = 0;
+    for (int p=0; p!=num_proc; ++p) {
+        int status;
+        if (wait(&status) == -1) {
+            if (errcode == 0) errcode = 4;
+        }
+        else if (WIFSIGNALED(status)) {
+            if (errcode == 0) errcode = 128 + WTERMSIG(status);
+        }
+        else if (WEXITSTATUS(status) == 1) {
+            if (errcode == 0) errcode = 1;
+        }
+        else if (WEXITSTATUS(status) == 2) {
+            if (errcode == 0) errcode = 2;
+        }
+        else if (WEXITSTATUS(status) != 0) {
+            if (errcode == 0) errcode = 97;
+        }
+    }
+    pthread_barrier_destroy(&sh->start);
+    pthread_barrier_destroy(&sh->done);
+    if (depot != NULL) shmheap_cache_depot_destroy(mem, depot);
+
+    // every block went back, so the heap must have coalesced into (nearly) one free block again
+    const char *result = errcode == 0 ? "ok" : errcode == 1 ? "wrong data" : errcode == 2 ? "out of memory" : "worker failed";
+    if (errcode == 0) {
+        void *all = shmheap_alloc(mem, HEAP_SIZE / 2);
+        if (all == NULL) {
+            result = "leaked";
+            errcode = 1;
+        }
+        else {
+            shmheap_free(mem, all);
+        }
+    }
+    shmheap_destroy(mem_name, mem);
+
+    // every iteration allocates once and frees (or sends, then frees) once
+    const double secs = (sh->last_end - sh->first_start) / 1e9;
+    const uint64_t lookups = sh->hits + sh->misses;
+    printf("%d,%s,%.0f,%.3f,%s\n", num_proc, use_cache ? "cache" : "direct", 2.0 * num_ops * num_proc / secs,
+        lookups == 0 ? 0.0 : (double)sh->hits / lookups, result);
+    fflush(stdout);
+    return errcode;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "-h") == 0) {
+        printf("usage: %s [max_processes=200] [ops_per_process=20000] [seed]\n", argv[0]);
+        return 1; // run failed
+    }
+    int max_proc = argc > 1 ? atoi(argv[1]) : MAX_PROCESSES;
+    if (max_proc < 1 || max_proc > MAX_PROCESSES) max_proc = MAX_PROCESSES;
+    const size_t num_ops = argc > 2 ? strtoull(argv[2], NULL, 10) : 20000;
+    if (argc > 3) {
+        const int seed = atoi(argv[3]);
+        srand(seed ? seed : time(NULL));
+    }
+
+    shared_state *const sh = mmap(NULL, sizeof(shared_state), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    assert(sh != MAP_FAILED);
+
+    int name_idx = 0;
+    int errcode = 0;
+    printf("processes,mode,ops/s,hit_rate,result\n");
+    for (int num_proc = 1; ; num_proc = num_proc * 2 > max_proc ? max_proc : num_proc * 2) {
+        for (int use_cache=0; use_cache!=2; ++use_cache) {
+            const int res = run(&name_idx, sh, num_proc, num_ops, use_cache);
+            if (errcode == 0) errcode = res;
+        }
+        if (num_proc == max_proc) break;
+    }
+
+    munmap(sh, sizeof(shared_state));
+    return errcode;
+}
@@ -0,0 +1,180 @@
+/**
+ * Per-process allocation cache over the shmheap API, see shmheap_cache.h.
+ *
+ * A block is [size_t class][payload]; class is the index of the size class,
+ * or UNCACHED for blocks too large to be worth stashing, which go straight
+ * back to the heap. The header lives in shared memory, so whichever process
+ * frees a block knows its class.
+ *
+ * A stash trades its older half with the depot as one magazine, keeping the
+ * recently freed (and likely still cached by the CPU) blocks. The depot lock
+ * is only ever taken before the heap's, never while holding it.
+ */
+
+#include <linux/futex.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "shmheap_cache.h"
+
+#define MIN_CLASS_SIZE 16
+#define UNCACHED SIZE_MAX
+
+static size_t class_of(size_t sz) {
+    size_t cls = 0;
+    for (size_t class_size = MIN_CLASS_SIZE; class_size < sz; class_size *= 2) {
+        if (++cls == SHMHEAP_CACHE_CLASSES) return UNCACHED;
+    }
+    return cls;
+}
+
+static size_t class_size(size_t cls) {
+    return (size_t)MIN_CLASS_SIZE << cls;
+}
+
+static void lock_depot(shmheap_cache_depot *depot) {
+    uint32_t c = 0;
+    if (__atomic_compare_exchange_n(&depot->lock, &c, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return;
+    if (c != 2) c = __atomic_exchange_n(&depot->lock, 2, __ATOMIC_ACQUIRE);
+    while (c != 0) {
+        syscall(SYS_futex, &depot->lock, FUTEX_WAIT, 2, NULL, NULL, 0);
+        c = __atomic_exchange_n(&depot->lock, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+static void unlock_depot(shmheap_cache_depot *depot) {
+    if (__atomic_exchange_n(&depot->lock, 0, __ATOMIC_RELEASE) == 2) {
+        syscall(SYS_futex, &depot->lock, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
+
+// returns every magazine in the depot to the heap
+static void depot_flush(shmheap_memory_handle mem, shmheap_cache_depot *depot) {
+    lock_depot(depot);
+    for (size_t cls=0; cls!=SHMHEAP_CACHE_CLASSES; ++cls) {
+        for (size_t m=0; m!=depot->count[cls]; ++m) {
+            for (size_t i=0; i!=SHMHEAP_CACHE_MAGAZINE; ++i) {
+                shmheap_free(mem, shmheap_handle_to_ptr(mem, depot->magazines[cls][m][i]));
+            }
+        }
+        depot->count[cls] = 0;
+    }
+    unlock_depot(depot);
+}
+
+shmheap_cache_depot *shmheap_cache_depot_create(shmheap_memory_handle mem) {
+    shmheap_cache_depot *depot = shmheap_alloc(mem, sizeof(shmheap_cache_depot));
+    if (depot != NULL) memset(depot, 0, sizeof(*depot));
+    return depot;
+}
+
+void shmheap_cache_depot_destroy(shmheap_memory_handle mem, shmheap_cache_depot *depot) {
+    depot_flush(mem, depot);
+    shmheap_free(mem, depot);
+}
+
+shmheap_cache *shmheap_cache_create(shmheap_memory_handle mem, shmheap_cache_depot *depot) {
+    shmheap_cache *cache = calloc(1, sizeof(shmheap_cache));
+    if (cache != NULL) {
+        cache->mem = mem;
+        cache->depot = depot;
+    }
+    return cache;
+}
+
+// moves a magazine from the depot into the empty stash of `cls`; returns false if the depot has none
+static bool take_magazine(shmheap_cache *cache, size_t cls) {
+    shmheap_cache_depot *const depot = cache->depot;
+    if (depot == NULL || __atomic_load_n(&depot->count[cls], __ATOMIC_RELAXED) == 0) return false;
+    lock_depot(depot);
+    const bool found = depot->count[cls] != 0;
+    if (found) {
+        const shmheap_object_handle *mag = depot->magazines[cls][--depot->count[cls]];
+        for (size_t i=0; i!=SHMHEAP_CACHE_MAGAZINE; ++i) {
+            cache->stash[cls][i] = shmheap_handle_to_ptr(cache->mem, mag[i]);
+        }
+    }
+    unlock_depot(depot);
+    if (found) cache->count[cls] = SHMHEAP_CACHE_MAGAZINE;
+    return found;
+}
+
+// moves the first SHMHEAP_CACHE_MAGAZINE blocks of the stash of `cls` into the depot; returns false if it is full
+static bool give_magazine(shmheap_cache *cache, size_t cls) {
+    shmheap_cache_depot *const depot = cache->depot;
+    if (depot == NULL) return false;
+    lock_depot(depot);
+    const bool room = depot->count[cls] != SHMHEAP_CACHE_DEPOT;
+    if (room) {
+        shmheap_object_handle *mag = depot->magazines[cls][depot->count[cls]++];
+        for (size_t i=0; i!=SHMHEAP_CACHE_MAGAZINE; ++i) {
+            mag[i] = shmheap_ptr_to_handle(cache->mem, cache->stash[cls][i]);
+        }
+    }
+    unlock_depot(depot);
+    return room;
+}
+
+void shmheap_cache_destroy(shmheap_cache *cache) {
+    shmheap_cache_flush(cache);
+    free(cache);
+}
+
+void *shmheap_cache_alloc(shmheap_cache *cache, size_t sz) {
+    const size_t cls = class_of(sz);
+    size_t *block;
+    if (cls != UNCACHED && (cache->count[cls] != 0 || take_magazine(cache, cls))) {
+        ++cache->hits;
+        block = cache->stash[cls][--cache->count[cls]];
+    }
+    else {
+        ++cache->misses;
+        // cached blocks are rounded up to their class, so any of them can serve any request of the class
+        block = shmheap_alloc(cache->mem, sizeof(size_t) + (cls == UNCACHED ? sz : class_size(cls)));
+        if (block == NULL) {
+            // the stashes and the depot may be holding the space this needs
+            shmheap_cache_flush(cache);
+            if (cache->depot != NULL) depot_flush(cache->mem, cache->depot);
+            block = shmheap_alloc(cache->mem, sizeof(size_t) + (cls == UNCACHED ? sz : class_size(cls)));
+            if (block == NULL) return NULL;
+        }
+        *block = cls;
+    }
+    return block + 1;
+}
+
+void shmheap_cache_free(shmheap_cache *cache, void *ptr) {
+    size_t *const block = (size_t*)ptr - 1;
+    const size_t cls = *block;
+    if (cls == UNCACHED) {
+        shmheap_free(cache->mem, block);
+        return;
+    }
+    if (cache->count[cls] == SHMHEAP_CACHE_DEPTH) {
+        // the older half goes to the depot in one go, or back to the heap block by block if it is full
+        const size_t half = SHMHEAP_CACHE_MAGAZINE;
+        if (!give_magazine(cache, cls)) {
+            for (size_t i=0; i!=half; ++i) {
+                shmheap_free(cache->mem, cache->stash[cls][i]);
+            }
+        }
+        for (size_t i=half; i!=SHMHEAP_CACHE_DEPTH; ++i) {
+            cache->stash[cls][i - half] = cache->stash[cls][i];
+        }
+        cache->count[cls] -= half;
+    }
+    cache->stash[cls][cache->count[cls]++] = block;
+}
+
+void shmheap_cache_flush(shmheap_cache *cache) {
+    for (size_t cls=0; cls!=SHMHEAP_CACHE_CLASSES; ++cls) {
+        for (size_t i=0; i!=cache->count[cls]; ++i) {
+            shmheap_free(cache->mem, cache->stash[cls][i]);
+        }
+        cache->count[cls] = 0;
+    }
+}
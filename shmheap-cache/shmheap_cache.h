@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "shmheap.h"
+
+/*
+A per-process allocation cache in front of any shmheap implementation.
+Freed blocks of the same size class are kept in a small per-process stash
+and handed out again without calling into the heap (and so without taking
+its lock).
+
+Stashes exchange whole magazines of SHMHEAP_CACHE_MAGAZINE blocks with an
+optional depot shared by all processes: an overflowing stash hands its older
+half to the depot, and an empty one takes a magazine back, each under a
+single acquisition of the depot's own lock rather than one heap lock per
+block. Only when the depot is empty (or full) do blocks come from (or go
+back to) the heap one call at a time, as the shmheap API has no batch calls.
+The depot lives in the heap: create it in one process, send
+shmheap_ptr_to_handle(mem, depot) to the others, and have them convert it
+back, as with shmheap_slab.
+
+Every block carries an 8-byte header recording its size class, so a block
+may be freed by a different process than the one that allocated it: convert
+pointers with shmheap_ptr_to_handle/shmheap_handle_to_ptr as usual, and free
+them through whichever process's cache ends up owning them.
+
+A cache belongs to one process and one connection: create it after fork,
+and destroy it (which returns its stash to the heap) before disconnecting.
+Destroy the depot (which returns its magazines to the heap) once every cache
+using it is gone.
+*/
+
+#define SHMHEAP_CACHE_CLASSES 7 /* 16, 32, ..., 1024 bytes */
+#define SHMHEAP_CACHE_DEPTH 32  /* blocks stashed per class */
+#define SHMHEAP_CACHE_MAGAZINE (SHMHEAP_CACHE_DEPTH / 2) /* blocks moved per depot lock */
+#define SHMHEAP_CACHE_DEPOT 32  /* full magazines the depot holds per class */
+
+// lives in the heap, so it holds offsets rather than pointers
+typedef struct {
+    uint32_t lock; // futex word, as in shmheap-ref
+    uint32_t count[SHMHEAP_CACHE_CLASSES];
+    shmheap_object_handle magazines[SHMHEAP_CACHE_CLASSES][SHMHEAP_CACHE_DEPOT][SHMHEAP_CACHE_MAGAZINE];
+} shmheap_cache_depot;
+
+typedef struct {
+    shmheap_memory_handle mem;
+    shmheap_cache_depot *depot; // NULL without one
+    size_t count[SHMHEAP_CACHE_CLASSES];
+    void *stash[SHMHEAP_CACHE_CLASSES][SHMHEAP_CACHE_DEPTH];
+    size_t hits, misses; // allocations served from the stash, and from the heap
+} shmheap_cache;
+
+shmheap_cache_depot *shmheap_cache_depot_create(shmheap_memory_handle mem);
+void shmheap_cache_depot_destroy(shmheap_memory_handle mem, shmheap_cache_depot *depot);
+shmheap_cache *shmheap_cache_create(shmheap_memory_handle mem, shmheap_cache_depot *depot);
+void shmheap_cache_destroy(shmheap_cache *cache);
+void *shmheap_cache_alloc(shmheap_cache *cache, size_t sz);
+void shmheap_cache_free(shmheap_cache *cache, void *ptr);
+void shmheap_cache_flush(shmheap_cache *cache);
@@ -0,0 +1,306 @@
+/**
+ * Reference shmheap implementation, used as the baseline that
+ * student submissions are compared against in benchmark reports.
+ *
+ * Layout of the shared memory (all offsets are in 8-byte units):
+ *  - unit 0: heap_header (64 bytes), holding the process-shared lock,
+ *    the heap size and the root of the tree of free blocks,
+ *  - unit 8 onwards: blocks, each starting with a 16-byte block_header.
+ * So the first object is at byte 80 and subsequent bookkeeping is 16 bytes,
+ * which is what prodder.c checks for.
+ *
+ * Placement is exactly address-ordered first-fit (so the ex2 transcripts match
+ * dynspace-ex2/simulate.cpp). The free blocks form a treap keyed by address
+ * whose nodes also hold the largest size in their subtree, as free_tree in
+ * dynspace-ex2/placement.hpp does, so both the first fit and every insertion
+ * and removal take O(log n) expected time. The priorities are a hash of the
+ * address, so nothing random needs to be shared.
+ * The tree lives in the free blocks' own headers: a free block never needs
+ * its prev_size (its left neighbour is allocated, as free neighbours are
+ * always coalesced), so that field holds the subtree's largest size instead.
+ * Neighbours are found in O(1) through the boundary tags in the block headers,
+ * so coalescing is O(1) apart from updating the tree.
+ * Nothing in the shared memory is an absolute pointer, and the heap is guarded
+ * by a futex-based lock in the first header, shared by all processes.
+ *
+ * Build it in place of a submission, e.g. in script.sh's stage, to get the
+ * baseline numbers of any grader or benchmark.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "shmheap.h"
+
+#define UNIT 8
+#define FIRST_BLOCK 8 /* sizeof(heap_header) / UNIT */
+#define HDR_UNITS 2   /* sizeof(block_header) / UNIT */
+#define USED_MARK UINT32_MAX
+
+typedef struct {
+    uint32_t lock;          // futex word: 0 = unlocked, 1 = locked, 2 = locked with waiters
+    uint32_t units;         // end of the last block
+    uint32_t root;          // root of the tree of free blocks, 0 if there are none
+    uint32_t reserved[13];  // keeps the first block at byte 64
+} heap_header;
+
+typedef struct {
+    uint32_t size;      // size of this block (including this header)
+    uint32_t prev_size; // allocated: size of the preceding block if that is free, else 0;
+                        // free: the largest size in its subtree
+    uint32_t left;      // left child in the tree of free blocks (0 if none), or USED_MARK if allocated
+    uint32_t right;     // right child in the tree of free blocks, 0 if none
+} block_header;
+
+_Static_assert(sizeof(heap_header) == FIRST_BLOCK * UNIT, "heap_header must be 64 bytes");
+_Static_assert(sizeof(block_header) == HDR_UNITS * UNIT, "block_header must be 16 bytes");
+
+static inline heap_header *header_of(void *base) {
+    return (heap_header *)base;
+}
+
+static inline block_header *block_at(void *base, uint32_t unit) {
+    return (block_header *)((char *)base + (size_t)unit * UNIT);
+}
+
+static void lock_heap(heap_header *hh) {
+    uint32_t c = 0;
+    if (__atomic_compare_exchange_n(&hh->lock, &c, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return;
+    if (c != 2) c = __atomic_exchange_n(&hh->lock, 2, __ATOMIC_ACQUIRE);
+    while (c != 0) {
+        syscall(SYS_futex, &hh->lock, FUTEX_WAIT, 2, NULL, NULL, 0);
+        c = __atomic_exchange_n(&hh->lock, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+static void unlock_heap(heap_header *hh) {
+    if (__atomic_exchange_n(&hh->lock, 0, __ATOMIC_RELEASE) == 2) {
+        syscall(SYS_futex, &hh->lock, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
+
+// treap priority of the free block at `unit`
+static inline uint32_t priority_of(uint32_t unit) {
+    uint32_t h = unit * 0x9E3779B1u;
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    return h ^ (h >> 13);
+}
+
+static inline uint32_t max_of(void *base, uint32_t t) {
+    return t == 0 ? 0 : block_at(base, t)->prev_size;
+}
+
+static void pull(void *base, uint32_t t) {
+    block_header *bh = block_at(base, t);
+    uint32_t m = bh->size;
+    if (max_of(base, bh->left) > m) m = max_of(base, bh->left);
+    if (max_of(base, bh->right) > m) m = max_of(base, bh->right);
+    bh->prev_size = m;
+}
+
+// splits the tree `t` into the blocks before `unit` (*a) and the rest (*b)
+static void split(void *base, uint32_t t, uint32_t unit, uint32_t *a, uint32_t *b) {
+    if (t == 0) {
+        *a = *b = 0;
+        return;
+    }
+    block_header *bh = block_at(base, t);
+    if (t < unit) {
+        split(base, bh->right, unit, &bh->right, b);
+        *a = t;
+    }
+    else {
+        split(base, bh->left, unit, a, &bh->left);
+        *b = t;
+    }
+    pull(base, t);
+}
+
+// joins two trees, every block of `a` being before every block of `b`
+static uint32_t merge(void *base, uint32_t a, uint32_t b) {
+    if (a == 0) return b;
+    if (b == 0) return a;
+    if (priority_of(a) > priority_of(b)) {
+        block_at(base, a)->right = merge(base, block_at(base, a)->right, b);
+        pull(base, a);
+        return a;
+    }
+    block_at(base, b)->left = merge(base, a, block_at(base, b)->left);
+    pull(base, b);
+    return b;
+}
+
+static void insert_free(void *base, uint32_t unit) {
+    heap_header *hh = header_of(base);
+    block_header *bh = block_at(base, unit);
+    bh->left = bh->right = 0;
+    bh->prev_size = bh->size;
+    uint32_t a, b;
+    split(base, hh->root, unit, &a, &b);
+    hh->root = merge(base, merge(base, a, unit), b);
+}
+
+// removes the free block at `unit` from the subtree `t`, returning the new root of the subtree
+static uint32_t remove_from(void *base, uint32_t t, uint32_t unit) {
+    block_header *bh = block_at(base, t);
+    if (t == unit) return merge(base, bh->left, bh->right);
+    if (unit < t) bh->left = remove_from(base, bh->left, unit);
+    else bh->right = remove_from(base, bh->right, unit);
+    pull(base, t);
+    return t;
+}
+
+static void remove_free(void *base, uint32_t unit) {
+    heap_header *hh = header_of(base);
+    hh->root = remove_from(base, hh->root, unit);
+    block_at(base, unit)->left = USED_MARK;
+}
+
+// the free block with the lowest address of at least `units`, or 0
+static uint32_t first_fit(void *base, uint32_t units) {
+    uint32_t t = header_of(base)->root;
+    if (max_of(base, t) < units) return 0;
+    while (true) {
+        block_header *bh = block_at(base, t);
+        if (max_of(base, bh->left) >= units) t = bh->left;
+        else if (bh->size >= units) return t;
+        else t = bh->right;
+    }
+}
+
+static inline bool is_free(void *base, uint32_t unit) {
+    return block_at(base, unit)->left != USED_MARK;
+}
+
+static shmheap_memory_handle map_heap(int fd, size_t len) {
+    shmheap_memory_handle mem = {NULL, len};
+    mem.base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem.base == MAP_FAILED) {
+        perror("shmheap: mmap");
+        exit(EXIT_FAILURE);
+    }
+    return mem;
+}
+
+shmheap_memory_handle shmheap_create(const char *name, size_t len) {
+    if (len < (FIRST_BLOCK + HDR_UNITS + 1) * UNIT || len / UNIT > UINT32_MAX) {
+        fprintf(stderr, "shmheap: unsupported heap size %zu\n", len);
+        exit(EXIT_FAILURE);
+    }
+    const int fd = shm_open(name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd == -1 || ftruncate(fd, len) == -1) {
+        perror("shmheap: shm_open");
+        exit(EXIT_FAILURE);
+    }
+    shmheap_memory_handle mem = map_heap(fd, len);
+    heap_header *hh = header_of(mem.base);
+    memset(hh, 0, sizeof(*hh));
+    hh->units = len / UNIT;
+    block_header *first = block_at(mem.base, FIRST_BLOCK);
+    first->size = hh->units - FIRST_BLOCK;
+    insert_free(mem.base, FIRST_BLOCK);
+    return mem;
+}
+
+shmheap_memory_handle shmheap_connect(const char *name) {
+    const int fd = shm_open(name, O_RDWR, 0);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror("shmheap: shm_open");
+        exit(EXIT_FAILURE);
+    }
+    return map_heap(fd, st.st_size);
+}
+
+void shmheap_disconnect(shmheap_memory_handle mem) {
+    munmap(mem.base, mem.len);
+}
+
+void shmheap_destroy(const char *name, shmheap_memory_handle mem) {
+    munmap(mem.base, mem.len);
+    shm_unlink(name);
+}
+
+void *shmheap_underlying(shmheap_memory_handle mem) {
+    return mem.base;
+}
+
+void *shmheap_alloc(shmheap_memory_handle mem, size_t sz) {
+    void *const base = mem.base;
+    heap_header *hh = header_of(base);
+    const size_t want = (sz + UNIT - 1) / UNIT + HDR_UNITS;
+    if (want > hh->units) return NULL;
+    const uint32_t units = want;
+
+    lock_heap(hh);
+    const uint32_t found = first_fit(base, units);
+    if (found == 0) {
+        unlock_heap(hh);
+        return NULL;
+    }
+    remove_free(base, found);
+    block_header *bh = block_at(base, found);
+    // the preceding block of a free block is allocated
+    bh->prev_size = 0;
+    const uint32_t rest = bh->size - units;
+    if (rest >= HDR_UNITS) {
+        const uint32_t split_at = found + units;
+        block_header *sh = block_at(base, split_at);
+        sh->size = rest;
+        if (split_at + rest < hh->units) block_at(base, split_at + rest)->prev_size = rest;
+        bh->size = units;
+        insert_free(base, split_at);
+    }
+    else if (found + bh->size < hh->units) {
+        block_at(base, found + bh->size)->prev_size = 0;
+    }
+    unlock_heap(hh);
+    return block_at(base, found + HDR_UNITS);
+}
+
+void shmheap_free(shmheap_memory_handle mem, void *ptr) {
+    void *const base = mem.base;
+    heap_header *hh = header_of(base);
+    uint32_t unit = ((char *)ptr - (char *)base) / UNIT - HDR_UNITS;
+
+    lock_heap(hh);
+    block_header *bh = block_at(base, unit);
+    uint32_t size = bh->size;
+    const uint32_t next = unit + size;
+    if (next < hh->units && is_free(base, next)) {
+        size += block_at(base, next)->size;
+        remove_free(base, next);
+    }
+    if (bh->prev_size != 0) {
+        unit -= bh->prev_size;
+        size += block_at(base, unit)->size;
+        remove_free(base, unit);
+        bh = block_at(base, unit);
+    }
+    bh->size = size;
+    if (unit + size < hh->units) block_at(base, unit + size)->prev_size = size;
+    insert_free(base, unit);
+    unlock_heap(hh);
+}
+
+shmheap_object_handle shmheap_ptr_to_handle(shmheap_memory_handle mem, void *ptr) {
+    shmheap_object_handle hdl = {(char *)ptr - (char *)mem.base};
+    return hdl;
+}
+
+void *shmheap_handle_to_ptr(shmheap_memory_handle mem, shmheap_object_handle hdl) {
+    return (char *)mem.base + hdl.offset;
+}
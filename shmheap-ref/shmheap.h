@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Handles of the reference implementation (see shmheap.c): the mapping,
+and the byte offset of an object from the start of the heap.
+*/
+
+typedef struct {
+    void *base;
+    size_t len;
+} shmheap_memory_handle;
+
+typedef struct {
+    size_t offset;
+} shmheap_object_handle;
+
+/*
+These functions form the public API of your shmheap library.
+*/
+
+shmheap_memory_handle shmheap_create(const char *name, size_t len);
+shmheap_memory_handle shmheap_connect(const char *name);
+void shmheap_disconnect(shmheap_memory_handle mem);
+void shmheap_destroy(const char *name, shmheap_memory_handle mem);
+void *shmheap_underlying(shmheap_memory_handle mem);
+void *shmheap_alloc(shmheap_memory_handle mem, size_t sz);
+void shmheap_free(shmheap_memory_handle mem, void *ptr);
+shmheap_object_handle shmheap_ptr_to_handle(shmheap_memory_handle mem, void *ptr);
+void *shmheap_handle_to_ptr(shmheap_memory_handle mem, shmheap_object_handle hdl);
@@ -0,0 +1,268 @@
+/**
+ * This benchmark compares shmheap_slab against the shmheap implementation it
+ * is linked with (normally a lock around a free list), under grader_ex3's
+ * pattern of concurrent 32-byte allocations:
+ *   alloc - every process allocates `objects` objects,
+ *   churn - three times, every process frees half of another process's
+ *           objects and allocates replacements (so handles cross processes),
+ *   free  - every process frees the objects of yet another process.
+ * Stages are separated by barriers. It runs at 1, 2, 4, ... processes up to
+ * `max_processes`, which defaults to the number of online CPUs, once for
+ * every placement pattern in SHMHEAP_PLACEMENT (a comma-separated list,
+ * "none" by default; see grader_affinity.h).
+ * Every object is tagged with its slot on allocation and checked before it is
+ * freed, so a slot handed out twice shows up as wrong data.
+ *
+ * Build it with any shmheap.c, e.g. from shmheap-ref/:
+ *   gcc -std=c99 -O2 -D_POSIX_C_SOURCE=200809L -D_GNU_SOURCE -I../shmheap-ref -I../grading-ex3 \
+ *       ../shmheap-ref/shmheap.c shmheap_slab.c bench_slab.c -lpthread -lrt
+ *
+ * Output is one CSV line per run:
+ * processes,placement,mode,alloc_ops/s,churn_ops/s,free_ops/s,total_ops/s,result
+ * Exit codes follow the shmheap graders: 1 for incorrect data,
+ * 128 + signal if a worker crashed, 97 for a weird worker exit code.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shmheap.h"
+#include "shmheap_slab.h"
+#include "grader_affinity.h"
+
+#define OBJECT_SIZE 32
+#define NUM_STAGES 5
+#define NUM_CHURNS 3
+
+// lives in MAP_SHARED memory, so every process of a run sees the same copy
+typedef struct {
+    pthread_barrier_t barrier;
+    shmheap_object_handle slab; // of the slab, in slab mode
+    uint64_t stage_start[NUM_STAGES], stage_end[NUM_STAGES]; // ns, over all workers
+    shmheap_object_handle handles[]; // objects of process p are at [p * objects, (p + 1) * objects)
+} shared_state;
+
+static const char *shm_prefix = "/shmheap";
+
+// names are /shmheap-<id>-<i>, as explained in grading-ex1/grader_ex1.c
+static const char *find_good_shm_name(int *i) {
+    static char run_id[48];
+    if (run_id[0] == '\0') {
+        const char *env = getenv("SHMHEAP_RUN_ID");
+        if (env != NULL && env[0] != '\0') {
+            snprintf(run_id, sizeof(run_id), "%s", env);
+        }
+        else {
+            unsigned int nonce = time(NULL);
+            const int fd = open("/dev/urandom", O_RDONLY);
+            if (fd != -1) {
+                read(fd, &nonce, sizeof(nonce));
+                close(fd);
+            }
+            snprintf(run_id, sizeof(run_id), "%d-%08x", (int)getpid(), nonce);
+        }
+    }
+    char *ret = malloc(80 * sizeof(char));
+    snprintf(ret, 80, "%s-%s-%d", shm_prefix, run_id, (*i)++);
+    return ret;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void record_min(uint64_t *target, uint64_t value) {
+    uint64_t cur = __atomic_load_n(target, __ATOMIC_RELAXED);
+    while (value < cur && !__atomic_compare_exchange_n(target, &cur, value, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void record_max(uint64_t *target, uint64_t value) {
+    uint64_t cur = __atomic_load_n(target, __ATOMIC_RELAXED);
+    while (value > cur && !__atomic_compare_exchange_n(target, &cur, value, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+typedef struct {
+    shmheap_memory_handle mem;
+    shmheap_slab *slab; // NULL when using the heap directly
+} allocator;
+
+static uint64_t *obj_alloc(allocator *a) {
+    return a->slab != NULL ? shmheap_slab_alloc(a->slab) : shmheap_alloc(a->mem, OBJECT_SIZE);
+}
+
+static void obj_free(allocator *a, void *ptr) {
+    if (a->slab != NULL) shmheap_slab_free(a->slab, ptr);
+    else shmheap_free(a->mem, ptr);
+}
+
+// allocates the object for slot `slot` and tags it, returning false if the allocator ran out
+static bool fill_slot(allocator *a, shared_state *sh, size_t slot) {
+    uint64_t *obj = obj_alloc(a);
+    if (obj == NULL) return false;
+    obj[0] = slot;
+    obj[1] = ~(uint64_t)slot;
+    sh->handles[slot] = shmheap_ptr_to_handle(a->mem, obj);
+    return true;
+}
+
+// frees the object in slot `slot`, returning false if it does not hold that slot's tag
+static bool empty_slot(allocator *a, shared_state *sh, size_t slot) {
+    uint64_t *obj = shmheap_handle_to_ptr(a->mem, sh->handles[slot]);
+    const bool ok = obj[0] == slot && obj[1] == ~(uint64_t)slot;
+    obj_free(a, obj);
+    return ok;
+}
+
+static int worker_proc(const char *mem_name, shared_state *sh, int proc, int num_proc, size_t objects, bool use_slab) {
+    allocator a = {shmheap_connect(mem_name), NULL};
+    if (use_slab) a.slab = shmheap_handle_to_ptr(a.mem, sh->slab);
+    bool ok = true;
+
+    for (int stage=0; stage!=NUM_STAGES; ++stage) {
+        // in every stage each range of slots is worked on by exactly one process, a different one each time
+        const size_t first = (size_t)((proc + stage) % num_proc) * objects;
+        pthread_barrier_wait(&sh->barrier);
+        const uint64_t begin = now_ns();
+        for (size_t i=0; i!=objects && ok; ++i) {
+            if (stage == 0) {
+                ok = fill_slot(&a, sh, first + i);
+            }
+            else if (stage == NUM_STAGES - 1) {
+                ok = empty_slot(&a, sh, first + i);
+            }
+            else if (i % 2 == stage % 2) {
+                ok = empty_slot(&a, sh, first + i) && fill_slot(&a, sh, first + i);
+            }
+        }
+        record_min(&sh->stage_start[stage], begin);
+        record_max(&sh->stage_end[stage], now_ns());
+    }
+
+    shmheap_disconnect(a.mem);
+    return ok ? 0 : 1;
+}
+
+static int run(int *name_idx, shared_state *sh, const affinity_plan *placement, int num_proc, size_t objects, bool use_slab, long page_size) {
+    const char *const mem_name = find_good_shm_name(name_idx);
+    // room for every object with a generous header each, plus the slab header
+    const size_t heap_size = ((objects * num_proc * (OBJECT_SIZE + 32) + (1 << 20)) / page_size + 1) * page_size;
+    shmheap_memory_handle mem = shmheap_create(mem_name, heap_size);
+
+    pthread_barrierattr_t attr;
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(&sh->barrier, &attr, num_proc);
+    pthread_barrierattr_destroy(&attr);
+    for (int stage=0; stage!=NUM_STAGES; ++stage) {
+        sh->stage_start[stage] = UINT64_MAX;
+        sh->stage_end[stage] = 0;
+    }
+    shmheap_slab *slab = NULL;
+    if (use_slab) {
+        slab = shmheap_slab_create(mem, OBJECT_SIZE, objects * num_proc);
+        assert(slab != NULL);
+        sh->slab = shmheap_ptr_to_handle(mem, slab);
+    }
+
+    fflush(stdout);
+    for (int p=0; p!=num_proc; ++p) {
+        const int res = fork();
+        assert(res != -1);
+        if (res == 0) {
+            affinity_pin(placement, p);
+            exit(worker_proc(mem_name, sh, p, num_proc, objects, use_slab));
+        }
+    }
+
+    int errcode = 0;
+    for (int p=0; p!=num_proc; ++p) {
+        int status;
+        if (wait(&status) == -1) {
+            if (errcode == 0) errcode = 4;
+        }
+        else if (WIFSIGNALED(status)) {
+            if (errcode == 0) errcode = 128 + WTERMSIG(status);
+        }
+        else if (WEXITSTATUS(status) == 1) {
+            if (errcode == 0) errcode = 1;
+        }
+        else if (WEXITSTATUS(status) != 0) {
+            if (errcode == 0) errcode = 97;
+        }
+    }
+    pthread_barrier_destroy(&sh->barrier);
+    if (slab != NULL) shmheap_slab_destroy(mem, slab);
+    shmheap_destroy(mem_name, mem);
+
+    // ops per stage: alloc and free do one per object, each churn frees and allocates half of them
+    const double n = (double)objects * num_proc;
+    double secs[NUM_STAGES], total_secs = 0;
+    for (int stage=0; stage!=NUM_STAGES; ++stage) {
+        secs[stage] = (sh->stage_end[stage] - sh->stage_start[stage]) / 1e9;
+        total_secs += secs[stage];
+    }
+    const double churn_secs = total_secs - secs[0] - secs[NUM_STAGES - 1];
+    printf("%d,%s,%s,%.0f,%.0f,%.0f,%.0f,%s\n", num_proc, placement->name, use_slab ? "slab" : "heap",
+        n / secs[0], NUM_CHURNS * n / churn_secs, n / secs[NUM_STAGES - 1], (2 + NUM_CHURNS) * n / total_secs,
+        errcode == 0 ? "ok" : errcode == 1 ? "wrong data" : "worker failed");
+    fflush(stdout);
+    return errcode;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "-h") == 0) {
+        printf("usage: %s [objects_per_process=100000] [max_processes=<online CPUs>]\n", argv[0]);
+        return 1; // run failed
+    }
+    const size_t objects = argc > 1 ? strtoull(argv[1], NULL, 10) : 100000;
+    int max_proc = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_proc < 1) max_proc = 1;
+    assert(objects > 0);
+
+    const long page_size = sysconf(_SC_PAGESIZE);
+    const size_t shared_size = sizeof(shared_state) + sizeof(shmheap_object_handle) * objects * max_proc;
+    shared_state *const sh = mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    assert(sh != MAP_FAILED);
+
+    int name_idx = 0;
+    int errcode = 0;
+    const char *patterns = getenv("SHMHEAP_PLACEMENT");
+    char *const pattern_list = strdup(patterns != NULL && patterns[0] != '\0' ? patterns : "none");
+    printf("processes,placement,mode,alloc_ops/s,churn_ops/s,free_ops/s,total_ops/s,result\n");
+    for (char *save, *pattern = strtok_r(pattern_list, ",", &save); pattern != NULL; pattern = strtok_r(NULL, ",", &save)) {
+        affinity_plan placement;
+        if (!affinity_plan_for(pattern, &placement)) {
+            fprintf(stderr, "Unknown placement %s\n", pattern);
+            return 1; // run failed
+        }
+        affinity_describe(&placement, stderr);
+        for (int num_proc = 1; ; num_proc = num_proc * 2 > max_proc ? max_proc : num_proc * 2) {
+            for (int use_slab=0; use_slab!=2; ++use_slab) {
+                const int res = run(&name_idx, sh, &placement, num_proc, objects, use_slab, page_size);
+                if (errcode == 0) errcode = res;
+            }
+            if (num_proc == max_proc) break;
+        }
+        affinity_free(&placement);
+    }
+    free(pattern_list);
+
+    munmap(sh, shared_size);
+    return errcode;
+}
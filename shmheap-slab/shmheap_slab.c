@@ -0,0 +1,71 @@
+/**
+ * Lock-free fixed-size slab in a shmheap heap, see shmheap_slab.h.
+ *
+ * The slab is one shmheap block: the shmheap_slab header, then `count`
+ * objects of `obj_size` bytes. A free object holds the index + 1 of the next
+ * free object in its first 4 bytes. A pop may read that link from an object
+ * that another process has just popped and is writing to; the value is then
+ * garbage, but the tag of the top has changed too, so the CAS fails and the
+ * pop starts over.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "shmheap_slab.h"
+
+#define INDEX_MASK 0xFFFFFFFFull
+
+static inline char *object_at(shmheap_slab *slab, uint32_t idx) {
+    return (char*)(slab + 1) + (size_t)idx * slab->obj_size;
+}
+
+static inline uint32_t *link_of(shmheap_slab *slab, uint32_t idx) {
+    return (uint32_t*)object_at(slab, idx);
+}
+
+shmheap_slab *shmheap_slab_create(shmheap_memory_handle mem, size_t obj_size, size_t count) {
+    obj_size = (obj_size + 7) / 8 * 8;
+    if (obj_size < sizeof(uint32_t)) obj_size = 8;
+    if (count == 0 || count >= INDEX_MASK || obj_size > UINT32_MAX) return NULL;
+    shmheap_slab *slab = shmheap_alloc(mem, sizeof(shmheap_slab) + obj_size * count);
+    if (slab == NULL) return NULL;
+    slab->obj_size = obj_size;
+    slab->count = count;
+    // every object starts free, linked in address order
+    for (uint32_t i=0; i!=count; ++i) {
+        *link_of(slab, i) = i + 1 == count ? 0 : i + 2;
+    }
+    __atomic_store_n(&slab->top, 1, __ATOMIC_RELEASE);
+    return slab;
+}
+
+void shmheap_slab_destroy(shmheap_memory_handle mem, shmheap_slab *slab) {
+    shmheap_free(mem, slab);
+}
+
+void *shmheap_slab_alloc(shmheap_slab *slab) {
+    uint64_t top = __atomic_load_n(&slab->top, __ATOMIC_ACQUIRE);
+    while (true) {
+        const uint32_t idx = top & INDEX_MASK;
+        if (idx == 0) return NULL;
+        const uint32_t next = __atomic_load_n(link_of(slab, idx - 1), __ATOMIC_RELAXED);
+        const uint64_t new_top = ((top >> 32) + 1) << 32 | next;
+        if (__atomic_compare_exchange_n(&slab->top, &top, new_top, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            return object_at(slab, idx - 1);
+        }
+    }
+}
+
+void shmheap_slab_free(shmheap_slab *slab, void *ptr) {
+    const uint32_t idx = ((char*)ptr - object_at(slab, 0)) / slab->obj_size + 1;
+    uint64_t top = __atomic_load_n(&slab->top, __ATOMIC_RELAXED);
+    while (true) {
+        __atomic_store_n(link_of(slab, idx - 1), (uint32_t)(top & INDEX_MASK), __ATOMIC_RELAXED);
+        const uint64_t new_top = ((top >> 32) + 1) << 32 | idx;
+        if (__atomic_compare_exchange_n(&slab->top, &top, new_top, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+    }
+}
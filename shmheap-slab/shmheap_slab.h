@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "shmheap.h"
+
+/*
+A lock-free allocator of fixed-size objects, carved out of one block of a
+shmheap heap. Free objects form a Treiber stack whose links are object
+indices and whose top carries a tag that changes on every update, so a
+stale compare-and-swap cannot succeed after the top was popped and pushed
+back (ABA). Nothing in it is an absolute pointer, so every process can use
+it through its own mapping of the heap.
+
+Objects live inside the heap, so their handles are ordinary
+shmheap_object_handles: convert them with shmheap_ptr_to_handle and
+shmheap_handle_to_ptr. The slab itself is shared the same way: create it in
+one process, send shmheap_ptr_to_handle(mem, slab) to the others, and have
+them convert it back.
+*/
+
+typedef struct {
+    uint64_t top;      // tag in the upper 32 bits, index + 1 of the top free object in the lower (0 = empty)
+    uint32_t obj_size; // bytes per object, a multiple of 8
+    uint32_t count;    // number of objects
+} shmheap_slab;
+
+shmheap_slab *shmheap_slab_create(shmheap_memory_handle mem, size_t obj_size, size_t count);
+void shmheap_slab_destroy(shmheap_memory_handle mem, shmheap_slab *slab);
+void *shmheap_slab_alloc(shmheap_slab *slab);
+void shmheap_slab_free(shmheap_slab *slab, void *ptr);